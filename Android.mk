@@ -52,11 +52,13 @@ LOCAL_SRC_FILES := \
 	common/compositor/renderstate.cpp \
 	common/compositor/scopedrendererstate.cpp \
 	common/core/headless.cpp \
+	common/core/frametimeline.cpp \
 	common/core/internaldisplay.cpp \
 	common/core/virtualdisplay.cpp \
 	common/core/gpudevice.cpp \
 	common/core/nativesync.cpp \
 	common/core/overlaylayer.cpp \
+	common/display/commitcoordinator.cpp \
 	common/display/displayplane.cpp \
 	common/display/displayplaneatomic.cpp \
 	common/display/displayplanemanager.cpp \
@@ -64,8 +66,10 @@ LOCAL_SRC_FILES := \
 	common/display/overlaybuffer.cpp \
 	common/display/pageflipeventhandler.cpp \
 	common/display/pageflipstate.cpp \
+	common/display/planeallocator.cpp \
 	common/utils/separate_rects.cpp \
 	common/utils/hwcthread.cpp \
+	common/utils/hwctrace.cpp \
 	os/android/grallocbufferhandler.cpp \
 	os/android/drmhwctwo.cpp \
 	public/drmscopedtypes.cpp \
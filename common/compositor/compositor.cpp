@@ -18,6 +18,9 @@
 
 #include <xf86drmMode.h>
 
+#include <algorithm>
+
+#include "displayplane.h"
 #include "displayplanestate.h"
 #include "hwctrace.h"
 #include "nativegpuresource.h"
@@ -31,6 +34,43 @@
 
 namespace hwcomposer {
 
+// Surfaces needed when every frame is composed with GPU: one on screen, one
+// pending flip and one being rendered.
+static const size_t kMinSurfaces = 3;
+// Default memory budget, in surfaces of the display size.
+static const size_t kDefaultMaxSurfaces = 4;
+// Frames after which an unused surface is freed.
+static const uint64_t kMaxSurfaceAge = 120;
+// How long to wait for a surface to be released when over budget. This
+// blocks the frame, so rather exceed the budget than miss a vblank.
+static const int kSurfaceWaitMs = 2;
+static const uint64_t kBytesPerPixel = 4;
+// Smallest part of a target scanned out on its own.
+static const int kMinTargetSize = 16;
+
+// Returns the bounding box of regions, clipped to surface_rect. Falls back
+// to surface_rect for boxes too small for a plane to scan out.
+static HwcRect<int> GetRegionBounds(
+    const std::vector<CompositionRegion> &regions,
+    const HwcRect<int> &surface_rect) {
+  HwcRect<int> bounds = regions.front().frame;
+  for (const CompositionRegion &region : regions) {
+    bounds.left = std::min(bounds.left, region.frame.left);
+    bounds.top = std::min(bounds.top, region.frame.top);
+    bounds.right = std::max(bounds.right, region.frame.right);
+    bounds.bottom = std::max(bounds.bottom, region.frame.bottom);
+  }
+
+  bounds.left = std::max(bounds.left, surface_rect.left);
+  bounds.top = std::max(bounds.top, surface_rect.top);
+  bounds.right = std::min(bounds.right, surface_rect.right);
+  bounds.bottom = std::min(bounds.bottom, surface_rect.bottom);
+  if (bounds.width() < kMinTargetSize || bounds.height() < kMinTargetSize)
+    return surface_rect;
+
+  return bounds;
+}
+
 Compositor::Compositor() {
 }
 
@@ -42,7 +82,7 @@ void Compositor::Init(NativeBufferHandler *buffer_handler, uint32_t width,
   buffer_handler_ = buffer_handler;
   gpu_fd_ = gpu_fd;
   if (!surfaces_.empty()) {
-    if (width == surfaces_.back()->GetWidth() ||
+    if (width == surfaces_.back()->GetWidth() &&
         height == surfaces_.back()->GetHeight())
       return;
 
@@ -50,6 +90,9 @@ void Compositor::Init(NativeBufferHandler *buffer_handler, uint32_t width,
       i->reset(nullptr);
       i = surfaces_.erase(i);
     }
+
+    std::vector<NativeSurface *>().swap(in_flight_surfaces_);
+    std::vector<NativeSurface *>().swap(unfenced_surfaces_);
   }
 
   gpu_resource_handler_.reset(CreateNativeGpuResourceHandler());
@@ -60,16 +103,21 @@ void Compositor::Init(NativeBufferHandler *buffer_handler, uint32_t width,
 
 bool Compositor::BeginFrame() {
   if (!renderer_) {
-    renderer_.reset(CreateRenderer());
-    if (!renderer_->Init()) {
+    std::unique_ptr<Renderer> renderer(CreateRenderer());
+    if (!renderer->Init()) {
       ETRACE("Failed to initialize OpenGL compositor %s", PRINTERROR());
-      renderer_.reset(nullptr);
       return false;
     }
+
+    std::lock_guard<std::mutex> renderer_guard(renderer_lock_);
+    renderer_.swap(renderer);
   }
 
-  if (!in_flight_surfaces_.empty())
-    std::vector<NativeSurface *>().swap(in_flight_surfaces_);
+  // Surfaces of a frame which never made it to EndFrame.
+  for (NativeSurface *surface : in_flight_surfaces_)
+    surface->SetReleaseFence(-1);
+
+  std::vector<NativeSurface *>().swap(in_flight_surfaces_);
 
   return true;
 }
@@ -77,6 +125,7 @@ bool Compositor::BeginFrame() {
 bool Compositor::Draw(DisplayPlaneStateList &comp_planes,
                       std::vector<OverlayLayer> &layers,
                       const std::vector<HwcRect<int>> &display_frame) {
+  HWC_TRACE_SLICE("Compositor::Draw");
   const DisplayPlaneState *comp = NULL;
   std::vector<size_t> dedicated_layers;
   ScopedRendererState state(renderer_.get());
@@ -113,7 +162,14 @@ bool Compositor::Draw(DisplayPlaneStateList &comp_planes,
       if (comp_regions.empty())
         continue;
 
-      Render(layers, in_flight_surfaces_.back(), comp_regions);
+      // Primary planes may not support being positioned, other planes only
+      // fetch the part of the target GPU rendered into.
+      NativeSurface *surface = in_flight_surfaces_.back();
+      HwcRect<int> bounds(0, 0, surface->GetWidth(), surface->GetHeight());
+      if (plane.plane()->type() != DRM_PLANE_TYPE_PRIMARY)
+        bounds = GetRegionBounds(comp_regions, bounds);
+
+      Render(layers, surface, comp_regions, bounds);
       plane.SetOverlayLayer(&layers.back());
     }
   }
@@ -154,57 +210,164 @@ bool Compositor::DrawOffscreen(std::vector<OverlayLayer> &layers,
   std::unique_ptr<NativeSurface> surface(CreateBackBuffer(width_, height_));
   surface->InitializeForOffScreenRendering(buffer_handler_, output_handle);
 
-  Render(layers, surface.get(), comp_regions);
+  Render(layers, surface.get(), comp_regions,
+         HwcRect<int>(0, 0, surface->GetWidth(), surface->GetHeight()));
 
   *retire_fence = layers.back().GetAcquireFence();
 
   return true;
 }
 
-void Compositor::EndFrame(bool commit_passed) {
-  if (commit_passed) {
-    for (auto &fb : surfaces_) {
-      fb->SetInUse(false);
+void Compositor::EndFrame(int release_fence) {
+  ScopedFd fence(release_fence);
+  // The surfaces might be on screen, never hand them out again without
+  // knowing when that ends.
+  unfenced_surfaces_.insert(unfenced_surfaces_.end(),
+                            in_flight_surfaces_.begin(),
+                            in_flight_surfaces_.end());
+  std::vector<NativeSurface *>().swap(in_flight_surfaces_);
+  if (fence.get() < 0) {
+    ETRACE("No release fence for composition surfaces, keeping them busy.");
+    return;
+  }
+
+  // A later frame's fence signals after the one it replaced on screen.
+  for (NativeSurface *surface : unfenced_surfaces_)
+    surface->SetReleaseFence(dup(fence.get()));
+
+  std::vector<NativeSurface *>().swap(unfenced_surfaces_);
+}
+
+void Compositor::UpdateSurfacePool() {
+  frame_++;
+  if (!renderer_ || surfaces_.empty())
+    return;
+
+  bool release = false;
+  for (auto &fb : surfaces_) {
+    if (frame_ - fb->GetLastUsedFrame() > kMaxSurfaceAge) {
+      release = true;
+      break;
     }
+  }
+
+  // While GPU composition is in use, allocate the surfaces it needs now
+  // rather than when the next frame gets composed.
+  bool grow = frame_ - last_render_frame_ <= 1 &&
+              surfaces_.size() < kMinSurfaces && CanCreateSurface();
+  if (!release && !grow)
+    return;
+
+  // GPU resources of surfaces are created and destroyed in our context.
+  ScopedRendererState state(renderer_.get());
+  if (!state.IsValid()) {
+    ETRACE("Failed to update surfaces without a valid context.");
+    return;
+  }
 
-    for (auto fb : in_flight_surfaces_) {
-      fb->SetInUse(true);
+  for (auto i = surfaces_.begin(); i != surfaces_.end();) {
+    if (frame_ - (*i)->GetLastUsedFrame() > kMaxSurfaceAge && (*i)->IsFree()) {
+      ICOMPOSITORTRACE("Releasing unused surface.");
+      i = surfaces_.erase(i);
+    } else {
+      ++i;
     }
   }
+
+  while (grow && surfaces_.size() < kMinSurfaces && CanCreateSurface()) {
+    if (!CreateSurface())
+      break;
+  }
+}
+
+void Compositor::SetMemoryBudget(uint64_t bytes) {
+  memory_budget_ = bytes;
+}
+
+bool Compositor::GetStatistics(RendererStatistics *stats) const {
+  std::lock_guard<std::mutex> renderer_guard(renderer_lock_);
+  if (!renderer_)
+    return false;
+
+  return renderer_->GetStatistics(stats);
 }
 
 bool Compositor::PrepareForComposition() {
+  // Prefer recently used surfaces, letting the others age out.
   NativeSurface *surface = NULL;
   for (auto &fb : surfaces_) {
-    if (!fb->InUse()) {
-      fb->SetInFlightSurface();
+    if (fb->IsFree() && (!surface || fb->GetLastUsedFrame() >
+                                         surface->GetLastUsedFrame()))
       surface = fb.get();
-      break;
-    }
   }
 
-  if (!surface) {
-    NativeSurface *new_surface = CreateBackBuffer(width_, height_);
-    new_surface->Init(buffer_handler_, gpu_fd_);
-    surfaces_.emplace_back(std::move(new_surface));
-    surface = surfaces_.back().get();
+  if (!surface && !CanCreateSurface()) {
+    // Over budget, wait for the surface released first.
+    NativeSurface *oldest = NULL;
+    for (auto &fb : surfaces_) {
+      if (fb->GetReleaseFence() >= 0 &&
+          (!oldest || fb->GetLastUsedFrame() < oldest->GetLastUsedFrame()))
+        oldest = fb.get();
+    }
+
+    if (oldest) {
+      ETRACE("Over composition memory budget, waiting for a surface.");
+      if (NativeSync::Wait(oldest->GetReleaseFence(), kSurfaceWaitMs) &&
+          oldest->IsFree())
+        surface = oldest;
+    }
+
+    if (!surface)
+      WTRACE("Exceeding composition memory budget.");
   }
 
+  if (!surface)
+    surface = CreateSurface();
+
+  if (!surface)
+    return false;
+
+  surface->SetInFlightSurface();
+  surface->SetLastUsedFrame(frame_);
+  last_render_frame_ = frame_;
   in_flight_surfaces_.emplace_back(surface);
   return true;
 }
 
+NativeSurface *Compositor::CreateSurface() {
+  std::unique_ptr<NativeSurface> surface(CreateBackBuffer(width_, height_));
+  if (!surface || !surface->Init(buffer_handler_, gpu_fd_)) {
+    ETRACE("Failed to create composition surface.");
+    return NULL;
+  }
+
+  surface->SetLastUsedFrame(frame_);
+
+  surfaces_.emplace_back(std::move(surface));
+  return surfaces_.back().get();
+}
+
+bool Compositor::CanCreateSurface() const {
+  // Double buffering is the least GPU composition can work with.
+  if (surfaces_.size() < 2)
+    return true;
+
+  uint64_t surface_size = (uint64_t)width_ * height_ * kBytesPerPixel;
+  uint64_t budget = memory_budget_ ? memory_budget_
+                                   : kDefaultMaxSurfaces * surface_size;
+  return (surfaces_.size() + 1) * surface_size <= budget;
+}
+
 void Compositor::AddOutputLayer(std::vector<OverlayLayer> &layers,
-                                 NativeSurface *surface) {
+                                NativeSurface *surface,
+                                const HwcRect<int> &bounds) {
   layers.emplace_back();
   OverlayLayer &pre_comp_layer = layers.back();
   pre_comp_layer.SetNativeHandle(surface->GetNativeHandle());
   pre_comp_layer.SetBlending(HWCBlending::kBlendingPremult);
   pre_comp_layer.SetTransform(0);
-  pre_comp_layer.SetSourceCrop(
-      HwcRect<float>(0, 0, surface->GetWidth(), surface->GetHeight()));
-  pre_comp_layer.SetDisplayFrame(
-      HwcRect<int>(0, 0, surface->GetWidth(), surface->GetHeight()));
+  pre_comp_layer.SetSourceCrop(HwcRect<float>(bounds));
+  pre_comp_layer.SetDisplayFrame(bounds);
   pre_comp_layer.SetBuffer(surface->GetBuffer());
   pre_comp_layer.SetAcquireFence(surface->ReleaseNativeFence());
   pre_comp_layer.SetIndex(layers.size() - 1);
@@ -212,7 +375,23 @@ void Compositor::AddOutputLayer(std::vector<OverlayLayer> &layers,
 
 void Compositor::Render(std::vector<OverlayLayer> &layers,
                         NativeSurface *surface,
-                        const std::vector<CompositionRegion> &comp_regions) {
+                        const std::vector<CompositionRegion> &comp_regions,
+                        const HwcRect<int> &bounds) {
+  // Have the GPU wait for producers, each source layer only once.
+  std::vector<bool> fence_inserted(layers.size(), false);
+  for (const CompositionRegion &region : comp_regions) {
+    for (size_t layer_index : region.source_layers) {
+      int fence = layers.at(layer_index).GetAcquireFence();
+      if (fence_inserted.at(layer_index) || fence < 0)
+        continue;
+
+      fence_inserted[layer_index] = true;
+      int fd = dup(fence);
+      if (fd >= 0)
+        renderer_->InsertFence(fd);
+    }
+  }
+
   std::vector<RenderState> states;
   size_t num_regions = comp_regions.size();
   states.reserve(num_regions);
@@ -230,8 +409,8 @@ void Compositor::Render(std::vector<OverlayLayer> &layers,
     states.emplace(it, state);
   }
 
-  renderer_->Draw(states, surface);
-  AddOutputLayer(layers, surface);
+  renderer_->Draw(states, surface, bounds);
+  AddOutputLayer(layers, surface, bounds);
 }
 
 // Below code is taken from drm_hwcomposer adopted to our needs.
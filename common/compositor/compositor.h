@@ -19,9 +19,12 @@
 
 #include <platformdefines.h>
 
+#include <mutex>
+
 #include "compositionregion.h"
 #include "displayplanestate.h"
 #include "factory.h"
+#include "renderer.h"
 
 namespace hwcomposer {
 
@@ -48,14 +51,34 @@ class Compositor {
                      const std::vector<HwcRect<int>> &display_frame,
                      const std::vector<size_t> &source_layers,
                      HWCNativeHandle output_handle, int32_t *retire_fence);
-  void EndFrame(bool commit_passed);
+  // release_fence, owned by the compositor, signals once the display stops
+  // reading the surfaces rendered this frame, i.e. on the flip of the frame
+  // replacing it. Without a fence, the surfaces stay busy till a later frame
+  // brings one.
+  void EndFrame(int release_fence);
+
+  // Called after each frame has been handed over for commit, outside the
+  // frame's critical path. Frees surfaces unused for a while and allocates
+  // the ones GPU composition is expected to need.
+  void UpdateSurfacePool();
+
+  // Caps the memory used by composition targets, 0 picks a default based
+  // on the display size.
+  void SetMemoryBudget(uint64_t bytes);
+
+  // GPU cost of recent compositions, false if it isn't being measured.
+  bool GetStatistics(RendererStatistics *stats) const;
 
  private:
   bool PrepareForComposition();
+  NativeSurface *CreateSurface();
+  bool CanCreateSurface() const;
+  // The output layer scans out bounds of surface at the same position.
   void AddOutputLayer(std::vector<OverlayLayer> &layers,
-                       NativeSurface *surface);
+                      NativeSurface *surface, const HwcRect<int> &bounds);
   void Render(std::vector<OverlayLayer> &layers, NativeSurface *surface,
-              const std::vector<CompositionRegion> &comp_regions);
+              const std::vector<CompositionRegion> &comp_regions,
+              const HwcRect<int> &bounds);
   void SeparateLayers(const std::vector<size_t> &dedicated_layers,
                       const std::vector<size_t> &source_layers,
                       const std::vector<HwcRect<int>> &display_frame,
@@ -68,8 +91,17 @@ class Compositor {
   uint32_t height_;
   std::vector<std::unique_ptr<NativeSurface>> surfaces_;
   std::unique_ptr<Renderer> renderer_;
+  // Guards renderer_ being set against GetStatistics, which is called from
+  // other threads than the one composing.
+  mutable std::mutex renderer_lock_;
   NativeBufferHandler *buffer_handler_;
   std::vector<NativeSurface *> in_flight_surfaces_;
+  // Surfaces of earlier frames which ended without a release fence.
+  std::vector<NativeSurface *> unfenced_surfaces_;
+  // Frames seen by UpdateSurfacePool and the last one composed with GPU.
+  uint64_t frame_ = 0;
+  uint64_t last_render_frame_ = 0;
+  uint64_t memory_budget_ = 0;
   std::unique_ptr<NativeGpuResource> gpu_resource_handler_;
 };
 }
@@ -122,4 +122,27 @@ EGLint EGLOffScreenContext::GetSyncFD() {
 #endif
 }
 
+bool EGLOffScreenContext::WaitForFence(EGLint fd) {
+#ifdef USE_ANDROID_SYNC
+  const EGLint attrib_list[] = {EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fd,
+                                EGL_NONE};
+  EGLSyncKHR egl_sync = eglCreateSyncKHR(
+      egl_display_, EGL_SYNC_NATIVE_FENCE_ANDROID, attrib_list);
+  if (egl_sync == EGL_NO_SYNC_KHR) {
+    ETRACE("Failed to import fence %d.", fd);
+    return false;
+  }
+
+  EGLint ret = eglWaitSyncKHR(egl_display_, egl_sync, 0);
+  eglDestroySyncKHR(egl_display_, egl_sync);
+  if (ret != EGL_TRUE)
+    ETRACE("Failed to wait for fence %d.", fd);
+
+  // The sync object owns fd from here on, even if the wait failed.
+  return true;
+#else
+  return false;
+#endif
+}
+
 }  // namespace hwcomposer
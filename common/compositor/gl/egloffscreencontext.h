@@ -37,6 +37,10 @@ class EGLOffScreenContext {
 
   EGLint GetSyncFD();
 
+  // Queues a server side wait for the native fence fd. On success EGL owns
+  // fd, otherwise it stays with the caller.
+  bool WaitForFence(EGLint fd);
+
  private:
   EGLDisplay egl_display_;
   EGLContext egl_ctx_;
@@ -16,6 +16,11 @@
 
 #include "glrenderer.h"
 
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
 #include "glprogram.h"
 #include "hwctrace.h"
 #include "nativesurface.h"
@@ -65,18 +70,116 @@ bool GLRenderer::Init() {
 
   vertex_array_.reset(vertex_array);
 
+  InitTimerQueries();
+
+  return true;
+}
+
+void GLRenderer::InitTimerQueries() {
+  const char *extensions =
+      reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+  if (!extensions || !strstr(extensions, "GL_EXT_disjoint_timer_query"))
+    return;
+
+  for (TimerQuery &timer_query : timer_queries_)
+    glGenQueriesEXT(1, &timer_query.query);
+
+  timer_query_supported_ = true;
+}
+
+void GLRenderer::ResolveTimerQueries() {
+  // Results are meaningless if the GPU went through a disjoint operation
+  // (e.g. a frequency change) since they were started.
+  GLint disjoint = 0;
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+  for (size_t i = 0; i < kMaxTimerQueries; i++) {
+    TimerQuery &timer_query =
+        timer_queries_[(next_timer_query_ + i) % kMaxTimerQueries];
+    if (!timer_query.pending)
+      continue;
+
+    GLuint available = 0;
+    glGetQueryObjectuivEXT(timer_query.query, GL_QUERY_RESULT_AVAILABLE_EXT,
+                           &available);
+    if (!available)
+      break;
+
+    timer_query.pending = false;
+    if (disjoint)
+      continue;
+
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64vEXT(timer_query.query, GL_QUERY_RESULT_EXT,
+                             &elapsed_ns);
+    std::lock_guard<std::mutex> lock(samples_lock_);
+    GpuTimeSample &sample = samples_[total_samples_ % kMaxGpuTimeSamples];
+    sample.gpu_ms = elapsed_ns / 1000000.0;
+    sample.pixels = timer_query.pixels;
+    sample.regions = timer_query.regions;
+    total_samples_++;
+  }
+}
+
+bool GLRenderer::GetStatistics(RendererStatistics *stats) const {
+  if (!timer_query_supported_)
+    return false;
+
+  std::vector<double> gpu_ms;
+  double pixels = 0;
+  double regions = 0;
+  {
+    std::lock_guard<std::mutex> lock(samples_lock_);
+    size_t count = total_samples_ < kMaxGpuTimeSamples ? total_samples_
+                                                       : kMaxGpuTimeSamples;
+    gpu_ms.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      gpu_ms.emplace_back(samples_[i].gpu_ms);
+      pixels += samples_[i].pixels;
+      regions += samples_[i].regions;
+    }
+  }
+
+  *stats = RendererStatistics();
+  if (gpu_ms.empty())
+    return true;
+
+  std::sort(gpu_ms.begin(), gpu_ms.end());
+  size_t count = gpu_ms.size();
+  double total = 0;
+  for (double sample : gpu_ms)
+    total += sample;
+
+  stats->frames = count;
+  stats->mean_gpu_ms = total / count;
+  stats->p99_gpu_ms = gpu_ms[count * 99 / 100];
+  stats->mean_pixels = pixels / count;
+  stats->mean_regions = regions / count;
   return true;
 }
 
 void GLRenderer::Draw(const std::vector<RenderState> &render_states,
-                      NativeSurface *surface) {
+                      NativeSurface *surface, const HwcRect<int> &bounds) {
+  HWC_TRACE_SLICE("GLRenderer::Draw");
   GLuint frame_width = surface->GetWidth();
   GLuint frame_height = surface->GetHeight();
   surface->MakeCurrent();
 
+  TimerQuery *timer_query = NULL;
+  if (timer_query_supported_) {
+    ResolveTimerQueries();
+    if (!timer_queries_[next_timer_query_].pending) {
+      timer_query = &timer_queries_[next_timer_query_];
+      timer_query->pixels = 0;
+      timer_query->regions = 0;
+      glBeginQueryEXT(GL_TIME_ELAPSED_EXT, timer_query->query);
+    }
+  }
+
   glViewport(0, 0, frame_width, frame_height);
-  glClear(GL_COLOR_BUFFER_BIT);
   glEnable(GL_SCISSOR_TEST);
+  glScissor(bounds.left, bounds.top, bounds.width(), bounds.height());
+  glClear(GL_COLOR_BUFFER_BIT);
 
   for (const RenderState &state : render_states) {
     unsigned size = state.layer_state_.size();
@@ -91,6 +194,10 @@ void GLRenderer::Draw(const std::vector<RenderState> &render_states,
 
     glScissor(state.x_, state.y_, state.width_, state.height_);
     glDrawArrays(GL_TRIANGLES, 0, 3);
+    if (timer_query) {
+      timer_query->pixels += state.width_ * state.height_;
+      timer_query->regions++;
+    }
 
     for (unsigned src_index = 0; src_index < size; src_index++) {
       glActiveTexture(GL_TEXTURE0 + src_index);
@@ -99,6 +206,12 @@ void GLRenderer::Draw(const std::vector<RenderState> &render_states,
   }
 
   glDisable(GL_SCISSOR_TEST);
+  if (timer_query) {
+    glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+    timer_query->pending = true;
+    next_timer_query_ = (next_timer_query_ + 1) % kMaxTimerQueries;
+  }
+
   surface->SetNativeFence(context_.GetSyncFD());
 }
 
@@ -110,6 +223,15 @@ bool GLRenderer::MakeCurrent() {
   return context_.MakeCurrent();
 }
 
+void GLRenderer::InsertFence(int fence) {
+  if (context_.WaitForFence(fence))
+    return;
+
+  // Buffers are still implicitly synchronised by the kernel.
+  ETRACE("Failed to queue GPU wait for fence %d.", fence);
+  close(fence);
+}
+
 GLProgram *GLRenderer::GetProgram(unsigned texture_count) {
   if (programs_.size() >= texture_count) {
     GLProgram *program = programs_[texture_count - 1].get();
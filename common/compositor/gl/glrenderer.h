@@ -17,6 +17,9 @@
 #ifndef GL_RENDERER_H_
 #define GL_RENDERER_H_
 
+#include <array>
+#include <mutex>
+
 #include "renderer.h"
 
 #include "egloffscreencontext.h"
@@ -30,20 +33,51 @@ class GLRenderer : public Renderer {
   GLRenderer() = default;
 
   bool Init() override;
-  void Draw(const std::vector<RenderState> &commands,
-            NativeSurface *surface) override;
+  void Draw(const std::vector<RenderState> &commands, NativeSurface *surface,
+            const HwcRect<int> &bounds) override;
 
   void RestoreState() override;
 
   bool MakeCurrent() override;
 
+  void InsertFence(int fence) override;
+
+  bool GetStatistics(RendererStatistics *stats) const override;
+
  private:
+  // GL_EXT_disjoint_timer_query around each Draw. Results are read back a
+  // few frames later, a frame is not timed if all queries are still busy.
+  struct TimerQuery {
+    GLuint query = 0;
+    bool pending = false;
+    uint64_t pixels = 0;
+    uint32_t regions = 0;
+  };
+
+  struct GpuTimeSample {
+    double gpu_ms = 0;
+    uint64_t pixels = 0;
+    uint32_t regions = 0;
+  };
+
+  static const size_t kMaxTimerQueries = 4;
+  static const size_t kMaxGpuTimeSamples = 128;
+
   GLProgram *GetProgram(unsigned texture_count);
+  void InitTimerQueries();
+  void ResolveTimerQueries();
 
   EGLOffScreenContext context_;
 
   std::vector<std::unique_ptr<GLProgram>> programs_;
   ScopedGLVertexArrayDeleter vertex_array_;
+
+  bool timer_query_supported_ = false;
+  std::array<TimerQuery, kMaxTimerQueries> timer_queries_;
+  size_t next_timer_query_ = 0;
+  mutable std::mutex samples_lock_;
+  std::array<GpuTimeSample, kMaxGpuTimeSamples> samples_;
+  size_t total_samples_ = 0;
 };
 
 }  // namespace hwcomposer
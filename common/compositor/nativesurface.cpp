@@ -18,6 +18,7 @@
 
 #include "hwctrace.h"
 #include "nativebufferhandler.h"
+#include "nativesync.h"
 
 namespace hwcomposer {
 
@@ -26,7 +27,6 @@ NativeSurface::NativeSurface(uint32_t width, uint32_t height)
       buffer_handler_(NULL),
       width_(width),
       height_(height),
-      ref_count_(0),
       in_flight_(false) {
 }
 
@@ -53,7 +53,6 @@ bool NativeSurface::Init(NativeBufferHandler *buffer_handler, uint32_t gpu_fd) {
     return false;
   }
 
-  ref_count_ = 0;
   width_ = overlay_buffer_->GetWidth();
   height_ = overlay_buffer_->GetHeight();
 
@@ -80,18 +79,27 @@ void NativeSurface::SetNativeFence(int fd) {
   fd_.Reset(fd);
 }
 
-void NativeSurface::SetInUse(bool inuse) {
-  if (inuse) {
-    ref_count_ = 3;
-  } else if (ref_count_) {
-    ref_count_--;
-  }
+void NativeSurface::SetInFlightSurface() {
+  in_flight_ = true;
+}
 
+void NativeSurface::SetReleaseFence(int release_fence) {
+  release_fence_.Reset(release_fence);
   in_flight_ = false;
 }
 
-void NativeSurface::SetInFlightSurface() {
-  in_flight_ = true;
+bool NativeSurface::IsFree() {
+  if (in_flight_)
+    return false;
+
+  if (release_fence_.get() < 0)
+    return true;
+
+  if (!NativeSync::GetSignalTime(release_fence_.get()))
+    return false;
+
+  release_fence_.Reset(-1);
+  return true;
 }
 
 }  // namespace hwcomposer
@@ -65,12 +65,28 @@ class NativeSurface {
     return fd_.Release();
   }
 
-  void SetInUse(bool inuse);
-
+  // Marks the surface as used by the frame being composed.
   void SetInFlightSurface();
 
-  bool InUse() const {
-    return ref_count_ > 1 || in_flight_;
+  // Called once the frame is done. release_fence, owned by the surface now,
+  // signals once the display stops reading the surface. -1 frees it right
+  // away.
+  void SetReleaseFence(int release_fence);
+
+  int GetReleaseFence() const {
+    return release_fence_.get();
+  }
+
+  // Returns true if the surface can be rendered into.
+  bool IsFree();
+
+  // Frame counter of the compositor, used to age out unused surfaces.
+  void SetLastUsedFrame(uint64_t frame) {
+    last_used_frame_ = frame;
+  }
+
+  uint64_t GetLastUsedFrame() const {
+    return last_used_frame_;
   }
 
  protected:
@@ -83,9 +99,10 @@ class NativeSurface {
   NativeBufferHandler* buffer_handler_;
   uint32_t width_;
   uint32_t height_;
-  uint32_t ref_count_;
   bool in_flight_;
+  uint64_t last_used_frame_ = 0;
   NativeFence fd_;
+  ScopedFd release_fence_;
 };
 
 }  // namespace hwcomposer
@@ -17,13 +17,26 @@
 #ifndef RENDERER_H_
 #define RENDERER_H_
 
+#include <stdint.h>
+
 #include <vector>
 
+#include <hwcdefs.h>
+
 namespace hwcomposer {
 
 class NativeSurface;
 struct RenderState;
 
+// GPU cost of recent compositions, averaged over the frames measured.
+struct RendererStatistics {
+  uint32_t frames = 0;
+  double mean_gpu_ms = 0;
+  double p99_gpu_ms = 0;
+  double mean_pixels = 0;
+  double mean_regions = 0;
+};
+
 class Renderer {
  public:
   Renderer() = default;
@@ -33,12 +46,23 @@ class Renderer {
   Renderer& operator=(const Renderer& rhs) = delete;
 
   virtual bool Init() = 0;
+  // Only the pixels of surface inside bounds are cleared and drawn.
   virtual void Draw(const std::vector<RenderState>& commands,
-                    NativeSurface* surface) = 0;
+                    NativeSurface* surface, const HwcRect<int>& bounds) = 0;
 
   virtual void RestoreState() = 0;
 
   virtual bool MakeCurrent() = 0;
+
+  // Makes the GPU wait for fence before running commands submitted after
+  // this call, without blocking the CPU. Takes ownership of fence.
+  virtual void InsertFence(int fence) = 0;
+
+  // Returns false if the renderer can't measure GPU time. Safe to call from
+  // any thread.
+  virtual bool GetStatistics(RendererStatistics* /*stats*/) const {
+    return false;
+  }
 };
 
 }  // namespace hwcomposer
@@ -0,0 +1,176 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "frametimeline.h"
+
+#include <time.h>
+
+#include <algorithm>
+
+namespace hwcomposer {
+
+static const int kNumStages = static_cast<int>(FrameStage::kNumStages);
+
+struct StageInterval {
+  FrameStage from;
+  FrameStage to;
+  const char *name;
+};
+
+static const StageInterval kIntervals[] = {
+    {FrameStage::kPresent, FrameStage::kImport, "import"},
+    {FrameStage::kImport, FrameStage::kValidate, "validate"},
+    {FrameStage::kValidate, FrameStage::kCompositionSubmit, "gpu-submit"},
+    {FrameStage::kCompositionSubmit, FrameStage::kCompositionDone,
+     "gpu-done"},
+    {FrameStage::kPresent, FrameStage::kCommit, "present-commit"},
+    {FrameStage::kCommit, FrameStage::kFlip, "commit-flip"},
+    {FrameStage::kPresent, FrameStage::kFlip, "present-flip"}};
+
+FrameTimeline::FrameTimeline() : last_frame_(0) {
+  for (Entry &entry : entries_) {
+    entry.frame.store(0, std::memory_order_relaxed);
+    entry.test_commits.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < kNumStages; i++)
+      entry.timestamps[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+int64_t FrameTimeline::Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+uint64_t FrameTimeline::BeginFrame() {
+  uint64_t frame = last_frame_.load(std::memory_order_relaxed) + 1;
+  Entry &entry = entries_[frame % kMaxFrames];
+  // Invalidate the entry first so readers don't mix up two frames.
+  entry.frame.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  entry.test_commits.store(0, std::memory_order_relaxed);
+  for (int i = 0; i < kNumStages; i++)
+    entry.timestamps[i].store(0, std::memory_order_relaxed);
+
+  entry.timestamps[static_cast<int>(FrameStage::kPresent)].store(
+      Now(), std::memory_order_relaxed);
+  entry.frame.store(frame, std::memory_order_release);
+  last_frame_.store(frame, std::memory_order_release);
+  return frame;
+}
+
+FrameTimeline::Entry *FrameTimeline::GetEntry(uint64_t frame) {
+  if (!frame)
+    return NULL;
+
+  Entry &entry = entries_[frame % kMaxFrames];
+  if (entry.frame.load(std::memory_order_acquire) != frame)
+    return NULL;
+
+  return &entry;
+}
+
+void FrameTimeline::Record(uint64_t frame, FrameStage stage,
+                           int64_t timestamp) {
+  Entry *entry = GetEntry(frame);
+  if (!entry)
+    return;
+
+  entry->timestamps[static_cast<int>(stage)].store(
+      timestamp ? timestamp : Now(), std::memory_order_relaxed);
+}
+
+void FrameTimeline::SetTestCommits(uint64_t frame, uint32_t test_commits) {
+  Entry *entry = GetEntry(frame);
+  if (entry)
+    entry->test_commits.store(test_commits, std::memory_order_relaxed);
+}
+
+bool FrameTimeline::ReadEntry(uint32_t index, FrameTiming *timing) const {
+  const Entry &entry = entries_[index % kMaxFrames];
+  uint64_t frame = entry.frame.load(std::memory_order_acquire);
+  if (!frame)
+    return false;
+
+  timing->frame = frame;
+  timing->test_commits = entry.test_commits.load(std::memory_order_relaxed);
+  for (int i = 0; i < kNumStages; i++)
+    timing->timestamps[i] = entry.timestamps[i].load(std::memory_order_relaxed);
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return entry.frame.load(std::memory_order_relaxed) == frame;
+}
+
+void FrameTimeline::GetFrames(uint32_t count,
+                              std::vector<FrameTiming> *frames) const {
+  frames->clear();
+  uint64_t last = last_frame_.load(std::memory_order_acquire);
+  count = std::min<uint64_t>(std::min(count, kMaxFrames - 1), last);
+  frames->reserve(count);
+  for (uint64_t frame = last - count + 1; frame <= last; frame++) {
+    FrameTiming timing;
+    if (ReadEntry(frame % kMaxFrames, &timing) && timing.frame == frame)
+      frames->emplace_back(timing);
+  }
+}
+
+void FrameTimeline::Dump(uint32_t count, std::ostringstream *out) const {
+  std::vector<FrameTiming> frames;
+  GetFrames(kMaxFrames, &frames);
+  *out << "  Frame timeline, " << frames.size() << " frames (us):\n";
+  if (frames.empty())
+    return;
+
+  std::vector<int64_t> samples;
+  for (const StageInterval &interval : kIntervals) {
+    samples.clear();
+    for (const FrameTiming &timing : frames) {
+      int64_t from = timing.timestamps[static_cast<int>(interval.from)];
+      int64_t to = timing.timestamps[static_cast<int>(interval.to)];
+      if (from && to >= from)
+        samples.emplace_back((to - from) / 1000);
+    }
+
+    if (samples.empty())
+      continue;
+
+    std::sort(samples.begin(), samples.end());
+    size_t size = samples.size();
+    *out << "    " << interval.name << ": p50 " << samples[size / 2]
+         << " p90 " << samples[size * 9 / 10] << " p99 "
+         << samples[size * 99 / 100] << " max " << samples.back() << "\n";
+  }
+
+  size_t first = frames.size() > count ? frames.size() - count : 0;
+  *out << "    frame: import validate gpu-submit gpu-done commit flip "
+          "(relative to present) test-commits\n";
+  for (size_t i = first; i < frames.size(); i++) {
+    const FrameTiming &timing = frames.at(i);
+    int64_t present = timing.timestamps[static_cast<int>(FrameStage::kPresent)];
+    *out << "    " << timing.frame << ":";
+    for (int stage = 1; stage < kNumStages; stage++) {
+      int64_t timestamp = timing.timestamps[stage];
+      if (timestamp)
+        *out << " " << (timestamp - present) / 1000;
+      else
+        *out << " -";
+    }
+
+    *out << " " << timing.test_commits << "\n";
+  }
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,71 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef FRAME_TIMELINE_H_
+#define FRAME_TIMELINE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <sstream>
+#include <vector>
+
+#include <hwcdefs.h>
+
+namespace hwcomposer {
+
+// Ring of per frame stage timestamps. Stages are recorded from Present,
+// CommitThread and DisplayManager threads without taking any lock; readers
+// discard entries which were recycled while being copied.
+class FrameTimeline {
+ public:
+  FrameTimeline();
+
+  // Starts a new frame and returns its id, which is never 0.
+  uint64_t BeginFrame();
+
+  // Records stage of frame at timestamp, or now if timestamp is 0. Ignored
+  // if frame is 0 or has already been recycled.
+  void Record(uint64_t frame, FrameStage stage, int64_t timestamp = 0);
+
+  void SetTestCommits(uint64_t frame, uint32_t test_commits);
+
+  // Fills frames with up to count most recent frames, oldest first.
+  void GetFrames(uint32_t count, std::vector<FrameTiming> *frames) const;
+
+  // Appends per stage latency percentiles and the last count frames.
+  void Dump(uint32_t count, std::ostringstream *out) const;
+
+  static int64_t Now();
+
+ private:
+  static const uint32_t kMaxFrames = 128;
+
+  struct Entry {
+    std::atomic<uint64_t> frame;
+    std::atomic<uint32_t> test_commits;
+    std::atomic<int64_t> timestamps[static_cast<int>(FrameStage::kNumStages)];
+  };
+
+  Entry *GetEntry(uint64_t frame);
+  bool ReadEntry(uint32_t index, FrameTiming *timing) const;
+
+  Entry entries_[kMaxFrames];
+  std::atomic<uint64_t> last_frame_;
+};
+
+}  // namespace hwcomposer
+#endif  // FRAME_TIMELINE_H_
@@ -19,8 +19,11 @@
 #include <stdlib.h>
 #include <time.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <xf86drm.h>
@@ -37,33 +40,54 @@
 #include "displayplanemanager.h"
 #endif
 
+#include "commitcoordinator.h"
 #include "headless.h"
 #include "internaldisplay.h"
 #include "virtualdisplay.h"
 #include "pageflipeventhandler.h"
 #include "pageflipstate.h"
+#include "planeallocator.h"
 
 namespace hwcomposer {
 
+// Time given to a burst of hot plug uevents to settle before connectors get
+// probed.
+static const int64_t kHotPlugSettleNs = 50 * 1000 * 1000;
+static const int kMaxEpollEvents = 8;
+
 static void page_flip_event(int /*fd*/, unsigned int frame, unsigned int sec,
-                            unsigned int usec, void *data) {
+                            unsigned int usec, unsigned int crtc_id,
+                            void *data) {
   IPAGEFLIPEVENTTRACE("page_flip_event called for frame %d", frame);
   PageFlipState *state = (PageFlipState *)data;
   if (!state)
     return;
 
-  PageFlipEventHandler *event_handler = state->GetFlipHandler();
+  // Merged commits send an event per CRTC, all with the same state.
+  PageFlipEventHandler *event_handler;
+  PageFlipState *merged_state = state->TakeMergedState(crtc_id);
+  if (merged_state) {
+    event_handler = merged_state->GetFlipHandler();
+    delete merged_state;
+  } else {
+    event_handler = state->GetFlipHandler();
+  }
+
+  if (state->FlipEventReceived()) {
+    IPAGEFLIPEVENTTRACE("Deleting page_flip_event state");
+    delete state;
+  }
 
-  IPAGEFLIPEVENTTRACE("Deleting page_flip_event state");
-  delete state;
   IPAGEFLIPEVENTTRACE("Handling VBlank call back.");
   event_handler->HandlePageFlipEvent(sec, usec);
 }
 
-static void vblank_event(int /*fd*/, unsigned int /*frame*/,
-                         unsigned int /*sec*/, unsigned int /*usec*/,
-                         void * /*data*/) {
+static void vblank_event(int /*fd*/, unsigned int /*frame*/, unsigned int sec,
+                         unsigned int usec, void *data) {
   IPAGEFLIPEVENTTRACE("vblank_event Called.");
+  PageFlipEventHandler *event_handler = (PageFlipEventHandler *)data;
+  if (event_handler)
+    event_handler->HandleVBlankEvent(sec, usec);
 }
 
 GpuDevice::DisplayManager::DisplayManager() : HWCThread(-8) {
@@ -72,7 +96,10 @@ GpuDevice::DisplayManager::DisplayManager() : HWCThread(-8) {
 
 GpuDevice::DisplayManager::~DisplayManager() {
   CTRACE();
+  Exit();
 #ifdef UDEV_SUPPORT
+  // The monitor owns its fd.
+  hotplug_fd_.Release();
   if (monitor_)
     udev_monitor_unref(monitor_);
 
@@ -85,6 +112,8 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
   CTRACE();
   fd_ = fd;
   ScopedDrmResourcesPtr res(drmModeGetResources(fd_));
+  commit_coordinator_.reset(new CommitCoordinator(fd_));
+  plane_allocator_.reset(new PlaneAllocator());
   buffer_handler_.reset(NativeBufferHandler::CreateInstance(fd_));
   if (!buffer_handler_) {
     ETRACE("Failed to create native buffer handler instance");
@@ -99,7 +128,9 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
     }
 
     std::unique_ptr<NativeDisplay> display(
-        new InternalDisplay(fd_, *(buffer_handler_.get()), i, c->crtc_id));
+        new InternalDisplay(fd_, *(buffer_handler_.get()), i, c->crtc_id,
+                            commit_coordinator_.get(),
+                            plane_allocator_.get()));
     if (!display->Initialize()) {
       ETRACE("Failed to Initialize Display %d", c->crtc_id);
       return false;
@@ -115,18 +146,58 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
     ETRACE("Failed to connect display.");
     return false;
   }
+
+  epoll_fd_.Reset(epoll_create1(EPOLL_CLOEXEC));
+  wake_fd_.Reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  hotplug_timer_fd_.Reset(
+      timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK));
+  if (epoll_fd_.get() < 0 || wake_fd_.get() < 0 ||
+      hotplug_timer_fd_.get() < 0) {
+    ETRACE("Failed to create event loop fds. %s", PRINTERROR());
+    return false;
+  }
+
+  if (!AddEventSource(fd_, kDrmEvent) ||
+      !AddEventSource(wake_fd_.get(), kWakeUp) ||
+      !AddEventSource(hotplug_timer_fd_.get(), kHotPlugTimer)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < displays_.size(); ++i) {
+    InternalDisplay *display =
+        static_cast<InternalDisplay *>(displays_[i].get());
+    if (!AddEventSource(display->GetVSyncTimerFd(), kVSyncTimer + i))
+      return false;
+  }
+
+  // Page flips and vsync keep working without hot plug support.
+  if (InitHotPlug() && AddEventSource(hotplug_fd_.get(), kHotPlugEvent)) {
+    IHOTPLUGEVENTTRACE("Initialization of ueventd/udev succeeded.");
+  }
+
+  if (!InitWorker("DisplayManager")) {
+    ETRACE("Failed to initalizer thread to monitor DRM events. %s",
+           PRINTERROR());
+    return false;
+  }
+
+  return true;
+}
+
+bool GpuDevice::DisplayManager::InitHotPlug() {
 #ifdef UDEV_SUPPORT
   udev_ = udev_new();
   if (udev_ == NULL) {
     ETRACE("Failed to create udev. %s", PRINTERROR());
-    return true;
+    return false;
   }
 
-  monitor_ = udev_monitor_new_from_netlink(udev, "udev");
+  monitor_ = udev_monitor_new_from_netlink(udev_, "udev");
   if (monitor_ == NULL) {
     ETRACE("Failed to create udev monitor. %s", PRINTERROR());
     udev_unref(udev_);
-    return true;
+    udev_ = NULL;
+    return false;
   }
 
   if (udev_monitor_filter_add_match_subsystem_devtype(monitor_, "drm",
@@ -134,34 +205,47 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
     ETRACE("Failed to add drm filter for udev monitor. %s", PRINTERROR());
     udev_unref(udev_);
     udev_monitor_unref(monitor_);
-    return true;
+    udev_ = NULL;
+    monitor_ = NULL;
+    hotplug_fd_.Release();
+    return false;
   }
   if (udev_monitor_filter_update(monitor_) < 0) {
     ETRACE("udev_monitor_filter_update failed. %s", PRINTERROR());
     udev_unref(udev_);
     udev_monitor_unref(monitor_);
-    return true;
+    udev_ = NULL;
+    monitor_ = NULL;
+    hotplug_fd_.Release();
+    return false;
   }
 
   if (udev_monitor_enable_receiving(monitor_) < 0) {
     ETRACE("Failed to enable udev monitor. %s", PRINTERROR());
     udev_unref(udev_);
     udev_monitor_unref(monitor_);
-    return true;
+    udev_ = NULL;
+    monitor_ = NULL;
+    hotplug_fd_.Release();
+    return false;
   }
 
-  hotplug_fd_.Reset(udev_monitor_get_fd(monitor));
-  if (hotplug_fd_ < 0) {
+  hotplug_fd_.Reset(udev_monitor_get_fd(monitor_));
+  if (hotplug_fd_.get() < 0) {
     ETRACE("Failed to retrieve udev monitor fd. %s", PRINTERROR());
     udev_unref(udev_);
     udev_monitor_unref(monitor_);
-    return true;
+    udev_ = NULL;
+    monitor_ = NULL;
+    hotplug_fd_.Release();
+    return false;
   }
 #else
-  hotplug_fd_.Reset(socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT));
+  hotplug_fd_.Reset(socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK,
+                           NETLINK_KOBJECT_UEVENT));
   if (hotplug_fd_.get() < 0) {
     ETRACE("Failed to create socket for hot plug monitor. %s", PRINTERROR());
-    return true;
+    return false;
   }
 
   struct sockaddr_nl addr;
@@ -174,20 +258,9 @@ bool GpuDevice::DisplayManager::Init(uint32_t fd) {
   if (ret) {
     ETRACE("Failed to bind sockaddr_nl and hot plug monitor fd. %s",
            PRINTERROR());
-    return true;
+    return false;
   }
 #endif
-  FD_ZERO(&fd_set_);
-  FD_SET(hotplug_fd_.get(), &fd_set_);
-  FD_SET(fd_, &fd_set_);
-  select_fd_ = std::max(hotplug_fd_.get(), fd_) + 1;
-  IHOTPLUGEVENTTRACE(
-      "Initialization of ueventd/udev succeeded. Initializing worker thread.");
-  if (!InitWorker("DisplayManager")) {
-    ETRACE("Failed to initalizer thread to monitor Hot Plug events. %s",
-           PRINTERROR());
-  }
-
   return true;
 }
 
@@ -198,6 +271,7 @@ void GpuDevice::DisplayManager::HotPlugEventHandler() {
   struct stat s;
   dev_t udev_devnum;
   const char *hotplug;
+  const char *connector;
 
   dev = udev_monitor_receive_device(monitor_);
   if (!dev) {
@@ -212,10 +286,11 @@ void GpuDevice::DisplayManager::HotPlugEventHandler() {
   fstat(fd_, &s);
 
   hotplug = udev_device_get_property_value(dev, "HOTPLUG");
+  connector = udev_device_get_property_value(dev, "CONNECTOR");
 
   if (memcmp(&s.st_rdev, &udev_devnum, sizeof(dev_t)) == 0 && hotplug &&
       atoi(hotplug) == 1)
-    UpdateDisplayState();
+    QueueHotPlug(connector ? strtoul(connector, NULL, 10) : 0);
 
   udev_device_unref(dev);
 }
@@ -224,69 +299,159 @@ void GpuDevice::DisplayManager::HotPlugEventHandler() {
   CTRACE();
   char buffer[1024];
   int ret;
-  bool drm_event = false, hotplug_event = false;
 
+  // Drain the socket, it's non blocking.
   while (true) {
-    ret = read(hotplug_fd_.get(), &buffer, sizeof(buffer));
+    ret = read(hotplug_fd_.get(), &buffer, sizeof(buffer) - 1);
     if (ret == 0) {
-      return;
+      break;
     } else if (ret < 0) {
-      ETRACE("Failed to read uevent. %s", PRINTERROR());
-      IHOTPLUGEVENTTRACE(
-          "Display management not possible as we failed to read uevent.");
-      return;
-    }
+      if (errno == EINTR)
+        continue;
 
-    if (drm_event && hotplug_event)
-      continue;
+      if (errno != EAGAIN) {
+        ETRACE("Failed to read uevent. %s", PRINTERROR());
+        IHOTPLUGEVENTTRACE(
+            "Display management not possible as we failed to read uevent.");
+      }
+      break;
+    }
 
+    buffer[ret] = '\0';
+    bool drm_event = false, hotplug_event = false;
+    uint32_t connector_id = 0;
     for (int32_t i = 0; i < ret;) {
       char *event = buffer + i;
-      if (strcmp(event, "DEVTYPE=drm_minor"))
+      if (!strcmp(event, "DEVTYPE=drm_minor"))
         drm_event = true;
-      else if (strcmp(event, "HOTPLUG=1"))
+      else if (!strcmp(event, "HOTPLUG=1"))
         hotplug_event = true;
-
-      if (hotplug_event && drm_event)
-        break;
+      else if (!strncmp(event, "CONNECTOR=", 10))
+        connector_id = strtoul(event + 10, NULL, 10);
 
       i += strlen(event) + 1;
     }
 
     if (drm_event && hotplug_event) {
-      IHOTPLUGEVENTTRACE(
-          "Recieved Hot Plug event related to display calling "
-          "UpdateDisplayState.");
-      UpdateDisplayState();
+      IHOTPLUGEVENTTRACE("Recieved Hot Plug event for connector %d.",
+                         connector_id);
+      QueueHotPlug(connector_id);
     }
   }
 }
 #endif
 
+void GpuDevice::DisplayManager::QueueHotPlug(uint32_t connector_id) {
+  // Older kernels don't tell which connector changed.
+  if (connector_id)
+    hotplug_connectors_.emplace_back(connector_id);
+  else
+    hotplug_all_connectors_ = true;
+
+  ArmHotPlugTimer();
+}
+
+void GpuDevice::DisplayManager::ArmHotPlugTimer() {
+  struct itimerspec timeout;
+  memset(&timeout, 0, sizeof(timeout));
+  timeout.it_value.tv_sec = kHotPlugSettleNs / (1000 * 1000 * 1000);
+  timeout.it_value.tv_nsec = kHotPlugSettleNs % (1000 * 1000 * 1000);
+  // Re-arming pushes the update out till the burst is over.
+  if (timerfd_settime(hotplug_timer_fd_.get(), 0, &timeout, NULL)) {
+    ETRACE("Failed to arm hot plug timer. %s", PRINTERROR());
+    ProcessHotPlug();
+  }
+}
+
+void GpuDevice::DisplayManager::HotPlugTimerHandler() {
+  uint64_t expirations;
+  if (read(hotplug_timer_fd_.get(), &expirations, sizeof(expirations)) < 0)
+    return;
+
+  IHOTPLUGEVENTTRACE("Hot plug settled.");
+  ProcessHotPlug();
+}
+
+void GpuDevice::DisplayManager::ProcessHotPlug() {
+  std::vector<uint32_t> connectors;
+  connectors.swap(hotplug_connectors_);
+  if (hotplug_all_connectors_) {
+    hotplug_all_connectors_ = false;
+    UpdateDisplayState();
+    return;
+  }
+
+  std::sort(connectors.begin(), connectors.end());
+  connectors.erase(std::unique(connectors.begin(), connectors.end()),
+                   connectors.end());
+  UpdateConnectors(connectors);
+}
+
+bool GpuDevice::DisplayManager::AddEventSource(int fd, uint32_t source) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u32 = source;
+  if (epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD, fd, &event)) {
+    ETRACE("Failed to add fd %d to event loop. %s", fd, PRINTERROR());
+    return false;
+  }
+
+  return true;
+}
+
+void GpuDevice::DisplayManager::HandleExit() {
+  uint64_t value = 1;
+  if (write(wake_fd_.get(), &value, sizeof(value)) < 0)
+    ETRACE("Failed to wake up DisplayManager. %s", PRINTERROR());
+}
+
 void GpuDevice::DisplayManager::Routine() {
   CTRACE();
+  struct epoll_event events[kMaxEpollEvents];
   int ret;
   IHOTPLUGEVENTTRACE("DisplayManager::Routine.");
   do {
-    ret = select(select_fd_, &fd_set_, NULL, NULL, NULL);
+    ret = epoll_wait(epoll_fd_.get(), events, kMaxEpollEvents, -1);
   } while (ret == -1 && errno == EINTR);
 
   if (ret < 0) {
-    IHOTPLUGEVENTTRACE("select() failed with %s:", PRINTERROR());
-  } else if (FD_ISSET(0, &fd_set_)) {
-    IHOTPLUGEVENTTRACE("select() exit due to user-input.");
-  } else {
-    if (FD_ISSET(hotplug_fd_.get(), &fd_set_)) {
-      IHOTPLUGEVENTTRACE("Recieved Hot plug notification.");
-      HotPlugEventHandler();
-    }
+    ETRACE("epoll_wait() failed with %s:", PRINTERROR());
+    return;
+  }
 
-    if (FD_ISSET(fd_, &fd_set_)) {
-      IPAGEFLIPEVENTTRACE("drmHandleEvent recieved.");
-      drmEventContext event_context = {.version = DRM_EVENT_CONTEXT_VERSION,
-                                       .vblank_handler = vblank_event,
-                                       .page_flip_handler = page_flip_event};
-      drmHandleEvent(fd_, &event_context);
+  for (int i = 0; i < ret; ++i) {
+    switch (events[i].data.u32) {
+      case kDrmEvent: {
+        IPAGEFLIPEVENTTRACE("drmHandleEvent recieved.");
+        drmEventContext event_context = {
+            .version = DRM_EVENT_CONTEXT_VERSION,
+            .vblank_handler = vblank_event,
+            .page_flip_handler = NULL,
+            .page_flip_handler2 = page_flip_event};
+        drmHandleEvent(fd_, &event_context);
+        break;
+      }
+      case kHotPlugEvent:
+        IHOTPLUGEVENTTRACE("Recieved Hot plug notification.");
+        HotPlugEventHandler();
+        break;
+      case kHotPlugTimer:
+        HotPlugTimerHandler();
+        break;
+      case kWakeUp: {
+        uint64_t value;
+        if (read(wake_fd_.get(), &value, sizeof(value)) < 0)
+          ETRACE("Failed to read wake up event. %s", PRINTERROR());
+        break;
+      }
+      default: {
+        size_t index = events[i].data.u32 - kVSyncTimer;
+        if (index < displays_.size())
+          static_cast<InternalDisplay *>(displays_[index].get())
+              ->HandleVSyncTimer();
+        break;
+      }
     }
   }
 }
@@ -299,128 +464,205 @@ bool GpuDevice::DisplayManager::UpdateDisplayState() {
     return false;
   }
 
-  int ret = Lock();
-  if (ret)
-    ETRACE("Failed to lock in GetDisplay %d", ret);
+  std::vector<uint32_t> connectors(res->connectors,
+                                   res->connectors + res->count_connectors);
+  // Connectors which went away, e.g. MST ones, get disconnected.
+  for (auto &state : connectors_) {
+    if (std::find(connectors.begin(), connectors.end(), state.first) ==
+        connectors.end())
+      connectors.emplace_back(state.first);
+  }
 
-  // Start of assuming no displays are connected
-  for (auto &display : displays_) {
-    display->DisConnect();
+  return UpdateConnectors(connectors);
+}
+
+// Returns the preferred mode of a connected connector, NULL otherwise.
+static const drmModeModeInfo *GetPreferredMode(
+    const drmModeConnector *connector) {
+  if (!connector || connector->connection != DRM_MODE_CONNECTED)
+    return NULL;
+
+  // There is only one preferred mode per connector.
+  for (int32_t i = 0; i < connector->count_modes; ++i) {
+    if (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED)
+      return &connector->modes[i];
   }
 
-  for (int32_t i = 0; i < res->count_connectors; ++i) {
-    ScopedDrmConnectorPtr connector(
-        drmModeGetConnector(fd_, res->connectors[i]));
-    if (!connector) {
-      ETRACE("Failed to get connector %d", res->connectors[i]);
-      ret = Unlock();
-      if (ret)
-        ETRACE("Failed to unlock in GetDisplay %d", ret);
+  return NULL;
+}
 
+static bool IsSameMode(const drmModeModeInfo &a, const drmModeModeInfo &b) {
+  return a.clock == b.clock && a.hdisplay == b.hdisplay &&
+         a.vdisplay == b.vdisplay && a.htotal == b.htotal &&
+         a.vtotal == b.vtotal && a.flags == b.flags && a.type == b.type;
+}
+
+// Displays expose all modes of their connector, so a monitor with the same
+// preferred mode but otherwise different modes or size needs a reconnect.
+static bool IsSameMonitor(const drmModeConnector *a,
+                          const drmModeConnector *b) {
+  if (a->count_modes != b->count_modes || a->mmWidth != b->mmWidth ||
+      a->mmHeight != b->mmHeight)
+    return false;
+
+  for (int32_t i = 0; i < a->count_modes; ++i) {
+    if (!IsSameMode(a->modes[i], b->modes[i]))
       return false;
-    }
+  }
 
-    // check if a monitor is connected.
-    if (connector->connection != DRM_MODE_CONNECTED)
+  return true;
+}
+
+bool GpuDevice::DisplayManager::UpdateConnectors(
+    const std::vector<uint32_t> &connector_ids) {
+  CTRACE();
+  struct ConnectorUpdate {
+    uint32_t id;
+    ScopedDrmConnectorPtr connector;
+    const drmModeModeInfo *mode = NULL;
+    // CRTC currently driven by the connector, if any.
+    uint32_t crtc_id = 0;
+    // Mask of pipes the connector's encoders can drive.
+    uint32_t possible_crtcs = 0;
+  };
+
+  // Probing connectors can take long, do it without holding the lock so
+  // displays which aren't affected keep presenting.
+  std::vector<ConnectorUpdate> updates;
+  for (uint32_t id : connector_ids) {
+    ConnectorUpdate update;
+    update.id = id;
+    update.connector.reset(drmModeGetConnector(fd_, id));
+    const drmModeConnector *connector = update.connector.get();
+    update.mode = GetPreferredMode(connector);
+    if (!update.mode)
+      update.connector.reset();
+
+    auto cached = connectors_.find(id);
+    bool was_connected = cached != connectors_.end() && cached->second.display;
+    if (!update.mode && !was_connected)
       continue;
 
-    // Ensure we have atleast one valid mode.
-    if (connector->count_modes == 0)
+    if (update.mode && was_connected &&
+        IsSameMonitor(connector, cached->second.connector.get())) {
       continue;
+    }
 
-    drmModeModeInfo mode;
-    for (int32_t i = 0; i < connector->count_modes; ++i) {
-      mode = connector->modes[i];
-      // There is only one preferred mode per connector.
-      if (mode.type & DRM_MODE_TYPE_PREFERRED) {
-        break;
+    if (update.mode) {
+      ScopedDrmEncoderPtr encoder(
+          drmModeGetEncoder(fd_, connector->encoder_id));
+      if (encoder)
+        update.crtc_id = encoder->crtc_id;
+
+      for (int32_t i = 0; i < connector->count_encoders; ++i) {
+        ScopedDrmEncoderPtr encoder(
+            drmModeGetEncoder(fd_, connector->encoders[i]));
+        if (encoder)
+          update.possible_crtcs |= encoder->possible_crtcs;
       }
     }
 
-    if (!(mode.type & DRM_MODE_TYPE_PREFERRED))
+    updates.emplace_back(std::move(update));
+  }
+
+  // The first update always publishes a table, even with nothing connected.
+  if (updates.empty() && std::atomic_load(&display_table_))
+    return true;
+
+  int ret = Lock();
+  if (ret)
+    ETRACE("Failed to lock in UpdateConnectors %d", ret);
+
+  // Release displays first, so their CRTCs can be reused below.
+  for (auto &update : updates) {
+    ConnectorState &state = connectors_[update.id];
+    if (!state.display)
       continue;
 
-    // Lets try to find crts for any connected encoder.
-    if (connector->encoder_id) {
-      ScopedDrmEncoderPtr encoder(
-          drmModeGetEncoder(fd_, connector->encoder_id));
-      if (encoder && encoder->crtc_id) {
-        for (auto &display : displays_) {
-          if (encoder->crtc_id == display->CrtcId() &&
-              display->Connect(mode, connector)) {
-            break;
-          }
-        }
+    IHOTPLUGEVENTTRACE("Connector %d changed, releasing its display.",
+                       update.id);
+    state.display->DisConnect();
+    state.display->ShutDown();
+    state.display = NULL;
+    state.connector.reset();
+  }
+
+  for (auto &update : updates) {
+    if (!update.connector)
+      continue;
+
+    NativeDisplay *target = NULL;
+    for (auto &display : displays_) {
+      if (!display->IsConnected() && display->CrtcId() == update.crtc_id) {
+        target = display.get();
+        break;
       }
     }
 
-    // Try to find an encoder for the connector.
-    for (int32_t i = 0; i < connector->count_encoders; ++i) {
-      ScopedDrmEncoderPtr encoder(
-          drmModeGetEncoder(fd_, connector->encoders[i]));
-      if (!encoder)
-        continue;
+    for (auto &display : displays_) {
+      if (target)
+        break;
 
-      // Check for compatible CRTC
-      int crtc_bit = 1 << i;
-      if (!(encoder->possible_crtcs & crtc_bit))
-        continue;
+      if (!display->IsConnected() &&
+          (update.possible_crtcs & (1 << display->Pipe())))
+        target = display.get();
+    }
 
-      for (auto &display : displays_) {
-        if (!display->IsConnected() && (1 << display->Pipe() & crtc_bit) &&
-            display->Connect(mode, connector)) {
-          break;
-        }
-      }
+    if (!target || !target->Connect(*update.mode, update.connector)) {
+      ETRACE("Failed to find a display for connector %d", update.id);
+      continue;
     }
+
+    ConnectorState &state = connectors_[update.id];
+    state.connector = std::move(update.connector);
+    state.display = target;
   }
 
+  PublishDisplayTable();
+
+  ret = Unlock();
+  if (ret)
+    ETRACE("Failed to unlock in UpdateConnectors %d", ret);
+
+  return true;
+}
+
+void GpuDevice::DisplayManager::PublishDisplayTable() {
+  std::shared_ptr<DisplayTable> table = std::make_shared<DisplayTable>();
   bool headless_mode = true;
   for (auto &display : displays_) {
-    if (!display->IsConnected()) {
-      display->ShutDown();
-    } else {
+    table->displays.emplace_back(display.get());
+    if (display->IsConnected())
       headless_mode = false;
-    }
   }
 
+  // Callers may still hold the headless display from an older table, so it
+  // stays around once created.
   if (headless_mode) {
     if (!headless_)
       headless_.reset(new Headless(fd_, *(buffer_handler_.get()), 0, 0));
-  } else if (headless_) {
-    headless_.release();
-  }
 
-  ret = Unlock();
-  if (ret)
-    ETRACE("Failed to unlock in GetDisplay %s", PRINTERROR());
+    table->headless = headless_.get();
+  }
 
-  return true;
+  std::atomic_store(&display_table_,
+                    std::shared_ptr<const DisplayTable>(std::move(table)));
 }
 
 NativeDisplay *GpuDevice::DisplayManager::GetDisplay(uint32_t display_id) {
   CTRACE();
-  int ret = Lock();
-  if (ret)
-    ETRACE("Failed to lock in GetDisplay %s", PRINTERROR());
+  std::shared_ptr<const DisplayTable> table =
+      std::atomic_load(&display_table_);
+  if (!table)
+    return NULL;
 
-  NativeDisplay *display = NULL;
-  if (headless_.get()) {
-    display = headless_.get();
-  } else {
-    for (auto &target : displays_) {
-      if (target->Pipe() == display_id) {
-        display = target.get();
-        break;
-      }
-    }
-  }
+  if (table->headless)
+    return table->headless;
 
-  ret = Unlock();
-  if (ret)
-    ETRACE("Failed to unlock in GetDisplay %s", PRINTERROR());
+  if (display_id >= table->displays.size())
+    return NULL;
 
-  return display;
+  return table->displays[display_id];
 }
 
 NativeDisplay *GpuDevice::DisplayManager::GetVirtualDisplay() {
@@ -433,6 +675,8 @@ GpuDevice::GpuDevice() : initialized_(false) {
 
 GpuDevice::~GpuDevice() {
   CTRACE();
+  // Stop handling events before the DRM fd gets closed.
+  display_manager_.Exit();
 }
 
 bool GpuDevice::Initialize() {
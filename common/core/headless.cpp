@@ -53,9 +53,13 @@ bool Headless::GetDisplayAttribute(uint32_t /*config*/,
       *value = 1;
       break;
     case HWCDisplayAttribute::kRefreshRate:
-      // in nanoseconds
+      // in Hz
       *value = 60;
       break;
+    case HWCDisplayAttribute::kVsyncPeriod:
+      // in nanoseconds
+      *value = 1000 * 1000 * 1000 / 60;
+      break;
     case HWCDisplayAttribute::kDpiX:
       // Dots per 1000 inches
       *value = 1;
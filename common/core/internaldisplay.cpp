@@ -16,6 +16,10 @@
 
 #include <internaldisplay.h>
 
+#include <time.h>
+
+#include <chrono>
+
 #include <hwcdefs.h>
 #include <hwclayer.h>
 #include <hwctrace.h>
@@ -26,31 +30,62 @@
 #include "displayplanemanager.h"
 #endif
 
+#include "commitcoordinator.h"
 #include "nativesync.h"
 #include "overlaylayer.h"
 #include "pageflipstate.h"
+#include "planeallocator.h"
 
 namespace hwcomposer {
 
 static const int32_t kUmPerInch = 25400;
+// Time left before vblank for the atomic commit to be programmed.
+static const int64_t kDefaultLatchMarginNs = 4 * 1000 * 1000;
+// How long commits may keep failing before buffers held for the frame on
+// screen are released anyway.
+static const int64_t kMaxFailedCommitNs = 100 * 1000 * 1000;
+
+static const int64_t kOneSecondNs = 1000 * 1000 * 1000;
+// Time without new content after which the screen is considered idle.
+static const int64_t kIdleTimeoutNs = kOneSecondNs;
+// Size of an EDID block and of its display descriptors.
+static const uint32_t kEdidBlockSize = 128;
+static const uint32_t kEdidDescriptorSize = 18;
+
+static int64_t GetMonotonicTimeNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+}
+
+static float GetModeRefreshRate(const drmModeModeInfo &mode) {
+  if (!mode.htotal || !mode.vtotal)
+    return 0;
+
+  return (mode.clock * 1000.0f) / (mode.htotal * mode.vtotal);
+}
 
 InternalDisplay::InternalDisplay(uint32_t gpu_fd,
                                  NativeBufferHandler &buffer_handler,
-                                 uint32_t pipe_id, uint32_t crtc_id)
+                                 uint32_t pipe_id, uint32_t crtc_id,
+                                 CommitCoordinator *coordinator,
+                                 PlaneAllocator *allocator)
     : buffer_handler_(buffer_handler),
+      coordinator_(coordinator),
+      allocator_(allocator),
       crtc_id_(crtc_id),
       pipe_(pipe_id),
       connector_(0),
-      blob_id_(0),
-      old_blob_id_(0),
       gpu_fd_(gpu_fd),
       is_connected_(false),
-      is_powered_off_(true) {
+      is_powered_off_(true),
+      latch_margin_ns_(kDefaultLatchMarginNs) {
 }
 
 InternalDisplay::~InternalDisplay() {
-  drmModeDestroyPropertyBlob(gpu_fd_, blob_id_);
-  drmModeDestroyPropertyBlob(gpu_fd_, old_blob_id_);
+  present_thread_.Exit();
+  commit_thread_.Exit();
+  ReleaseModeBlobs();
 }
 
 bool InternalDisplay::Initialize() {
@@ -59,6 +94,7 @@ bool InternalDisplay::Initialize() {
   GetDrmObjectProperty("ACTIVE", crtc_props, &active_prop_);
   GetDrmObjectProperty("MODE_ID", crtc_props, &mode_id_prop_);
   GetDrmObjectProperty("OUT_FENCE_PTR", crtc_props, &out_fence_ptr_prop_);
+  GetDrmObjectProperty("VRR_ENABLED", crtc_props, &vrr_enabled_prop_);
 
 #ifdef USE_DRM_ATOMIC
   int ret = drmSetClientCap(gpu_fd_, DRM_CLIENT_CAP_ATOMIC, 1);
@@ -68,14 +104,26 @@ bool InternalDisplay::Initialize() {
   }
 
   display_plane_manager_.reset(
-      new DisplayPlaneManagerAtomic(gpu_fd_, pipe_, crtc_id_));
+      new DisplayPlaneManagerAtomic(gpu_fd_, pipe_, crtc_id_, coordinator_,
+                                    allocator_));
 #else
   display_plane_manager_.reset(
-      new DisplayPlaneManager(gpu_fd_, pipe_, crtc_id_));
+      new DisplayPlaneManager(gpu_fd_, pipe_, crtc_id_, allocator_));
 #endif
   frame_ = 0;
 
-  return display_plane_manager_->Initialize();
+  if (!display_plane_manager_->Initialize())
+    return false;
+
+  if (!sync_timeline_.Init()) {
+    ETRACE("InternalDisplay failed initializing sync timeline.");
+    return false;
+  }
+
+  if (!flip_handler_.InitVSync(gpu_fd_, pipe_))
+    return false;
+
+  return commit_thread_.Init(this);
 }
 
 uint32_t InternalDisplay::Fd() const {
@@ -85,6 +133,7 @@ uint32_t InternalDisplay::Fd() const {
 bool InternalDisplay::Connect(const drmModeModeInfo &mode_info,
                               const ScopedDrmConnectorPtr &connector) {
   IHOTPLUGEVENTTRACE("InternalDisplay::Connect recieved.");
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
   // TODO(kalyan): Add support for multi monitor case.
   if (connector->connector_id == connector_ && !is_powered_off_) {
     IHOTPLUGEVENTTRACE("Display is already connected to this connector.");
@@ -92,14 +141,26 @@ bool InternalDisplay::Connect(const drmModeModeInfo &mode_info,
     return true;
   }
   IHOTPLUGEVENTTRACE("Display is being connected to a new connector.");
-  mode_ = mode_info;
+  ReleaseModeBlobs();
+  modes_.assign(connector->modes, connector->modes + connector->count_modes);
+  mode_blobs_.assign(modes_.size(), 0);
   connector_ = connector->connector_id;
-  width_ = mode_.hdisplay;
-  height_ = mode_.vdisplay;
-  refresh_ = (mode_.clock * 1000.0f) / (mode_.htotal * mode_.vtotal);
-  dpix_ = connector->mmWidth ? (width_ * kUmPerInch) / connector->mmWidth : -1;
-  dpiy_ =
-      connector->mmHeight ? (height_ * kUmPerInch) / connector->mmHeight : -1;
+  mm_width_ = connector->mmWidth;
+  mm_height_ = connector->mmHeight;
+  uint32_t config = 0;
+  for (uint32_t i = 0; i < modes_.size(); i++) {
+    if (!memcmp(&modes_[i], &mode_info, sizeof(drmModeModeInfo))) {
+      config = i;
+      break;
+    }
+  }
+
+  if (modes_.empty()) {
+    modes_.emplace_back(mode_info);
+    mode_blobs_.emplace_back(0);
+  }
+
+  UpdateMode(config);
 
   ScopedDrmObjectPropertyPtr connector_props(drmModeObjectGetProperties(
       gpu_fd_, connector_, DRM_MODE_OBJECT_CONNECTOR));
@@ -110,10 +171,19 @@ bool InternalDisplay::Connect(const drmModeModeInfo &mode_info,
 
   GetDrmObjectProperty("DPMS", connector_props, &dpms_prop_);
   GetDrmObjectProperty("CRTC_ID", connector_props, &crtc_prop_);
-  flip_handler_.Init(refresh_);
+  // Tiles of a panel scan out in lockstep, commit them together.
+  coordinator_->SetSyncGroup(crtc_id_, GetTileGroup(connector_props));
+  uint32_t min_refresh = 0;
+  vrr_capable_ = vrr_enabled_prop_ &&
+                 GetVariableRefreshRange(connector_props, &min_refresh);
+  vrr_max_frame_ns_ = min_refresh ? kOneSecondNs / min_refresh : 0;
+  if (vrr_requested_)
+    pending_operations_ |= kVariableRefresh;
+
   is_powered_off_ = false;
   is_connected_ = true;
-  compositor_.Init(&buffer_handler_, width_, height_, gpu_fd_);
+  // The next frame sets the compositor up for the new size, on the thread
+  // composing it.
   return true;
 }
 
@@ -122,39 +192,62 @@ void InternalDisplay::DisConnect() {
     return;
 
   is_connected_ = false;
+  if (allocator_)
+    allocator_->ReleasePipe(pipe_);
 }
 
 void InternalDisplay::ShutDown() {
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
   if (is_powered_off_)
     return;
 
   is_powered_off_ = true;
   pending_operations_ |= kModeset;
+  coordinator_->SetSyncGroup(crtc_id_, 0);
+  if (allocator_)
+    allocator_->ReleasePipe(pipe_);
+
   // TODO(kalyank): Power off the device here.
 }
 
-bool InternalDisplay::GetDisplayAttribute(uint32_t /*config*/,
+bool InternalDisplay::GetDisplayAttribute(uint32_t config,
                                           HWCDisplayAttribute attribute,
                                           int32_t *value) {
-  // We always get the values from preferred mode config.
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  if (config >= modes_.size()) {
+    *value = -1;
+    return false;
+  }
+
+  const drmModeModeInfo &mode = modes_[config];
   switch (attribute) {
     case HWCDisplayAttribute::kWidth:
-      *value = width_;
+      *value = mode.hdisplay;
       break;
     case HWCDisplayAttribute::kHeight:
-      *value = height_;
+      *value = mode.vdisplay;
       break;
     case HWCDisplayAttribute::kRefreshRate:
-      // in nanoseconds
-      *value = refresh_;
+      // in Hz, rounded
+      *value = static_cast<int32_t>(GetModeRefreshRate(mode) + 0.5f);
+      break;
+    case HWCDisplayAttribute::kVsyncPeriod:
+      // in nanoseconds, clock is in kHz
+      if (!mode.clock) {
+        *value = -1;
+        return false;
+      }
+
+      *value = static_cast<int32_t>(static_cast<int64_t>(mode.htotal) *
+                                    mode.vtotal * 1000 * 1000 / mode.clock);
       break;
     case HWCDisplayAttribute::kDpiX:
       // Dots per 1000 inches
-      *value = dpix_;
+      *value = mm_width_ ? (mode.hdisplay * kUmPerInch) / mm_width_ : -1;
       break;
     case HWCDisplayAttribute::kDpiY:
       // Dots per 1000 inches
-      *value = dpiy_;
+      *value = mm_height_ ? (mode.vdisplay * kUmPerInch) / mm_height_ : -1;
       break;
     default:
       *value = -1;
@@ -166,18 +259,27 @@ bool InternalDisplay::GetDisplayAttribute(uint32_t /*config*/,
 
 bool InternalDisplay::GetDisplayConfigs(uint32_t *num_configs,
                                         uint32_t *configs) {
-  *num_configs = 1;
-  if (!configs)
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  uint32_t count = modes_.size();
+  if (!configs) {
+    *num_configs = count;
     return true;
+  }
 
-  configs[0] = 1;
+  *num_configs = std::min(*num_configs, count);
+  for (uint32_t i = 0; i < *num_configs; i++)
+    configs[i] = i;
 
   return true;
 }
 
 bool InternalDisplay::GetDisplayName(uint32_t *size, char *name) {
   std::ostringstream stream;
-  stream << "InternalDisplay-" << connector_;
+  {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
+    stream << "InternalDisplay-" << connector_;
+  }
+
   std::string string = stream.str();
   size_t length = string.length();
   if (!name) {
@@ -190,68 +292,111 @@ bool InternalDisplay::GetDisplayName(uint32_t *size, char *name) {
   return true;
 }
 
-bool InternalDisplay::SetActiveConfig(uint32_t /*config*/) {
+bool InternalDisplay::SetActiveConfig(uint32_t config) {
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  if (config >= modes_.size())
+    return false;
+
+  // Refresh rate changes within the same resolution usually don't need the
+  // pipe to be shut down, let the kernel tell us.
+  if (!(pending_operations_ & kModeset) && !is_powered_off_ &&
+      config != config_ && CanSwitchSeamlessly(config)) {
+    IDISPLAYMANAGERTRACE("Seamless switch to config %d.", config);
+    pending_operations_ |= PendingModeset::kModeSwitch;
+    UpdateMode(config);
+    return true;
+  }
+
   pending_operations_ |= PendingModeset::kModeset;
   pending_operations_ |= PendingModeset::kDpms;
   dpms_mode_ = DRM_MODE_DPMS_ON;
-  if (old_blob_id_) {
-    drmModeDestroyPropertyBlob(gpu_fd_, old_blob_id_);
-    old_blob_id_ = 0;
-  }
-
+  UpdateMode(config);
   return true;
 }
 
 bool InternalDisplay::GetActiveConfig(uint32_t *config) {
-  if (!config)
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  if (!config || modes_.empty())
     return false;
 
-  config[0] = 1;
+  config[0] = config_;
   return true;
 }
 
 bool InternalDisplay::SetDpmsMode(uint32_t dpms_mode) {
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
   dpms_mode_ = dpms_mode;
   pending_operations_ |= PendingModeset::kDpms;
   return true;
 }
 
-bool InternalDisplay::ApplyPendingModeset(drmModeAtomicReqPtr property_set,
-                                          uint64_t *out_fence) {
-  if (pending_operations_ & kDpms) {
-    int ret = drmModeConnectorSetProperty(gpu_fd_, connector_, dpms_prop_,
-                                          dpms_mode_);
+void InternalDisplay::TakePendingOperations(QueuedFrame *frame) {
+  frame->pending_operations = pending_operations_;
+  pending_operations_ = kNone;
+  frame->mode_blob =
+      modes_.empty() ? 0 : GetModeBlob(idle_ ? idle_mode_ : config_);
+  frame->connector = connector_;
+  frame->dpms_mode = dpms_mode_;
+  frame->vrr_enable = vrr_capable_ && vrr_requested_;
+  frame->width = width_;
+  frame->height = height_;
+}
+
+void InternalDisplay::RestorePendingOperations(const QueuedFrame *frame) {
+  if (frame->pending_operations == kNone)
+    return;
+
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  pending_operations_ |= frame->pending_operations;
+}
+
+bool InternalDisplay::ApplyPendingModeset(QueuedFrame *frame) {
+  drmModeAtomicReqPtr property_set = frame->pset.get();
+  uint32_t operations = frame->pending_operations;
+  if (operations & kDpms) {
+    int ret = drmModeConnectorSetProperty(gpu_fd_, frame->connector,
+                                          dpms_prop_, frame->dpms_mode);
     if (ret) {
-      ETRACE("Failed to set DPMS property for connector %d", connector_);
+      ETRACE("Failed to set DPMS property for connector %d",
+             frame->connector);
       return false;
     }
-
-    pending_operations_ &= ~kDpms;
   }
 
-  if (pending_operations_ & kModeset) {
-    drmModeCreatePropertyBlob(gpu_fd_, &mode_, sizeof(drmModeModeInfo),
-                              &blob_id_);
-    if (blob_id_ == 0)
+  if (operations & (kModeset | kModeSwitch)) {
+    uint32_t blob_id = frame->mode_blob;
+    if (blob_id == 0)
       return false;
 
-    int ret = drmModeAtomicAddProperty(property_set, crtc_id_, crtc_prop_,
-                                       blob_id_) < 0 ||
-              drmModeAtomicAddProperty(property_set, connector_, crtc_prop_,
-                                       crtc_id_) < 0;
+    int ret = drmModeAtomicAddProperty(property_set, crtc_id_, mode_id_prop_,
+                                       blob_id) < 0;
+    if (operations & kModeset) {
+      ret = ret ||
+            drmModeAtomicAddProperty(property_set, crtc_id_, active_prop_,
+                                     1) < 0 ||
+            drmModeAtomicAddProperty(property_set, frame->connector,
+                                     crtc_prop_, crtc_id_) < 0;
+    }
+
     if (ret) {
-      ETRACE("Failed to add blob %d to pset", blob_id_);
+      ETRACE("Failed to add blob %d to pset", blob_id);
       return false;
     }
+  }
 
-    pending_operations_ &= ~kModeset;
-    old_blob_id_ = blob_id_;
-    blob_id_ = 0;
+  if (operations & kVariableRefresh) {
+    if (drmModeAtomicAddProperty(property_set, crtc_id_, vrr_enabled_prop_,
+                                 frame->vrr_enable) < 0) {
+      ETRACE("Failed to add VRR_ENABLED property to pset");
+      return false;
+    }
   }
 
   if (out_fence_ptr_prop_ != 0) {
+    // The kernel writes the fence fd to this s32 when committing.
+    uint64_t out_fence = reinterpret_cast<uintptr_t>(&frame->out_fence);
     int ret = drmModeAtomicAddProperty(property_set, crtc_id_,
-                                       out_fence_ptr_prop_, *out_fence);
+                                       out_fence_ptr_prop_, out_fence);
     if (ret < 0) {
       ETRACE("Failed to add OUT_FENCE_PTR property to pset: %d", ret);
       return false;
@@ -261,6 +406,17 @@ bool InternalDisplay::ApplyPendingModeset(drmModeAtomicReqPtr property_set,
   return true;
 }
 
+bool InternalDisplay::CanToggleVariableRefresh(bool enable) const {
+  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+  if (!pset ||
+      drmModeAtomicAddProperty(pset.get(), crtc_id_, vrr_enabled_prop_,
+                               enable) < 0)
+    return false;
+
+  return !drmModeAtomicCommit(gpu_fd_, pset.get(), DRM_MODE_ATOMIC_TEST_ONLY,
+                              NULL);
+}
+
 bool InternalDisplay::GetDrmObjectProperty(
     const char *name, const ScopedDrmObjectPropertyPtr &props,
     uint32_t *id) const {
@@ -280,41 +436,209 @@ bool InternalDisplay::GetDrmObjectProperty(
   return false;
 }
 
-void InternalDisplay::AddFenceToRetireFence(int fd, NativeSync *sync) {
-  if (fd < 0)
+bool InternalDisplay::GetVariableRefreshRange(
+    const ScopedDrmObjectPropertyPtr &props, uint32_t *min_refresh) const {
+  bool capable = false;
+  *min_refresh = 0;
+  for (uint32_t i = 0; i < props->count_props; i++) {
+    ScopedDrmPropertyPtr property(drmModeGetProperty(gpu_fd_, props->props[i]));
+    if (!property)
+      continue;
+
+    if (!strcmp(property->name, "vrr_capable")) {
+      capable = props->prop_values[i];
+      continue;
+    }
+
+    if (strcmp(property->name, "EDID") || !props->prop_values[i])
+      continue;
+
+    ScopedDrmPropertyBlobPtr blob(
+        drmModeGetPropertyBlob(gpu_fd_, props->prop_values[i]));
+    if (!blob || blob->length < kEdidBlockSize)
+      continue;
+
+    // The range limits descriptor, tag 0xfd, holds the vertical rates in
+    // bytes 5 and 6, with byte 4 flagging rates offset by 255.
+    const uint8_t *edid = static_cast<const uint8_t *>(blob->data);
+    for (uint32_t offset = 54; offset + kEdidDescriptorSize <= kEdidBlockSize;
+         offset += kEdidDescriptorSize) {
+      const uint8_t *descriptor = edid + offset;
+      if (descriptor[0] || descriptor[1] || descriptor[3] != 0xfd)
+        continue;
+
+      *min_refresh = descriptor[5] + ((descriptor[4] & 0x1) ? 255 : 0);
+      break;
+    }
+  }
+
+  return capable;
+}
+
+uint32_t InternalDisplay::GetTileGroup(
+    const ScopedDrmObjectPropertyPtr &props) const {
+  for (uint32_t i = 0; i < props->count_props; i++) {
+    ScopedDrmPropertyPtr property(drmModeGetProperty(gpu_fd_, props->props[i]));
+    if (!property || strcmp(property->name, "TILE") || !props->prop_values[i])
+      continue;
+
+    ScopedDrmPropertyBlobPtr blob(
+        drmModeGetPropertyBlob(gpu_fd_, props->prop_values[i]));
+    if (!blob || !blob->length)
+      return 0;
+
+    // The blob is a string of colon separated values, starting with the
+    // group id.
+    std::string tile(static_cast<const char *>(blob->data), blob->length);
+    return strtoul(tile.c_str(), NULL, 10);
+  }
+
+  return 0;
+}
+
+void InternalDisplay::UpdateMode(uint32_t config) {
+  config_ = config;
+  idle_ = false;
+  mode_ = modes_[config];
+  width_ = mode_.hdisplay;
+  height_ = mode_.vdisplay;
+  refresh_ = GetModeRefreshRate(mode_);
+  downclock_mode_ = -1;
+  dpix_ = mm_width_ ? (width_ * kUmPerInch) / mm_width_ : -1;
+  dpiy_ = mm_height_ ? (height_ * kUmPerInch) / mm_height_ : -1;
+  flip_handler_.Init(refresh_, this);
+}
+
+uint32_t InternalDisplay::GetModeBlob(uint32_t config) {
+  uint32_t &blob_id = mode_blobs_[config];
+  if (!blob_id) {
+    drmModeCreatePropertyBlob(gpu_fd_, &modes_[config],
+                              sizeof(drmModeModeInfo), &blob_id);
+  }
+
+  return blob_id;
+}
+
+bool InternalDisplay::CanSwitchSeamlessly(uint32_t config) {
+  const drmModeModeInfo &mode = modes_[config];
+  if (mode.hdisplay != mode_.hdisplay || mode.vdisplay != mode_.vdisplay ||
+      (mode.flags & DRM_MODE_FLAG_INTERLACE) !=
+          (mode_.flags & DRM_MODE_FLAG_INTERLACE))
+    return false;
+
+  uint32_t blob_id = GetModeBlob(config);
+  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+  if (!blob_id || !pset ||
+      drmModeAtomicAddProperty(pset.get(), crtc_id_, mode_id_prop_,
+                               blob_id) < 0)
+    return false;
+
+  // Without DRM_MODE_ATOMIC_ALLOW_MODESET, this fails if the new mode needs
+  // the pipe to be shut down.
+  return !drmModeAtomicCommit(gpu_fd_, pset.get(), DRM_MODE_ATOMIC_TEST_ONLY,
+                              NULL);
+}
+
+void InternalDisplay::FindDownclockMode() {
+  if (downclock_mode_ >= 0)
     return;
 
-  if (next_retire_fence_.get() >= 0) {
-    int old_fence = next_retire_fence_.get();
-    next_retire_fence_.Reset(sync->MergeFence(old_fence, fd));
-  } else {
-    next_retire_fence_.Reset(fd);
+  downclock_mode_ = config_;
+  downclock_refresh_ = refresh_;
+  for (uint32_t i = 0; i < modes_.size(); i++) {
+    float refresh = GetModeRefreshRate(modes_[i]);
+    if (refresh > 0 && refresh < downclock_refresh_ &&
+        CanSwitchSeamlessly(i)) {
+      downclock_mode_ = i;
+      downclock_refresh_ = refresh;
+    }
   }
 }
 
+void InternalDisplay::ReleaseModeBlobs() {
+  // The kernel keeps a blob alive while the CRTC still uses it.
+  for (uint32_t blob_id : mode_blobs_) {
+    if (blob_id)
+      drmModeDestroyPropertyBlob(gpu_fd_, blob_id);
+  }
+
+  mode_blobs_.clear();
+}
+
 bool InternalDisplay::Present(
     std::vector<hwcomposer::HwcLayer *> &source_layers, int32_t *retire_fence) {
   CTRACE();
+  HWC_TRACE_SLICE("Present");
   *retire_fence = -1;
-  // Create a Sync object for this Composition.
-  std::unique_ptr<NativeSync> sync_object(new NativeSync());
-  if (!sync_object->Init()) {
-    ETRACE("InternalDisplay failed initializing Native Sync Object.");
-    return false;
+  int64_t now = GetMonotonicTimeNs();
+  bool new_content = !IsSameContent(source_layers);
+  if (new_content) {
+    SaveContent(source_layers);
+    content_ns_ = now;
+    LeaveIdleMode();
+  }
+
+  // Without new content, a frame is still needed to give up shared planes
+  // or to switch to the idle mode.
+  if (!new_content &&
+      !(allocator_ && allocator_->HasPlanesToRelease(pipe_)) &&
+      (IsIdle() || now - content_ns_ < kIdleTimeoutNs || !EnterIdleMode())) {
+    // Nothing changed, the last frame stays on screen and the buffers are
+    // released along with it.
+    HWC_TRACE_SLICE("IdleFrame");
+    for (HwcLayer *layer : source_layers) {
+      int ret =
+          layer->release_fence.Reset(sync_timeline_.CreateFence(sync_point_));
+      if (ret < 0)
+        ETRACE("Failed to create fence for layer, error: %s", PRINTERROR());
+    }
+
+    if (retire_sync_point_)
+      *retire_fence = sync_timeline_.CreateFence(retire_sync_point_);
+
+    retire_sync_point_ = sync_point_;
+    // Unused surfaces keep aging while nothing is composed.
+    if (present_worker_) {
+      std::lock_guard<std::mutex> present_guard(present_lock_);
+      surface_pool_update_ = true;
+      present_cond_.notify_all();
+    } else {
+      compositor_.UpdateSurfacePool();
+    }
+
+    return true;
   }
 
-  // Merge previous frame fence to Retire fence.
-  AddFenceToRetireFence(out_fence_.Release(), sync_object.get());
+  {
+    std::lock_guard<std::mutex> queue_guard(queue_lock_);
+    if (last_present_ns_) {
+      int64_t interval = now - last_present_ns_;
+      present_interval_ns_ =
+          present_interval_ns_ ? (present_interval_ns_ * 3 + interval) / 4
+                               : interval;
+    }
 
-  std::vector<OverlayLayer> layers;
-  std::vector<HwcRect<int>> layers_rects;
+    last_present_ns_ = now;
+  }
+
+  std::unique_ptr<QueuedFrame> frame(new QueuedFrame());
+  {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
+    TakePendingOperations(frame.get());
+  }
+
+  // Tiles committing meanwhile wait for this frame while it is composed.
+  coordinator_->SetWorkQueued(crtc_id_, true);
+
+  frame->timeline_frame = timeline_.BeginFrame();
+  frame->sync_point = ++sync_point_;
+  int sync_point = frame->sync_point;
 
-  int ret = 0;
   size_t size = source_layers.size();
   for (size_t layer_index = 0; layer_index < size; layer_index++) {
     HwcLayer *layer = source_layers.at(layer_index);
-    layers.emplace_back();
-    OverlayLayer &overlay_layer = layers.back();
+    frame->layers.emplace_back();
+    OverlayLayer &overlay_layer = frame->layers.back();
     overlay_layer.SetNativeHandle(layer->GetNativeHandle());
     overlay_layer.SetTransform(layer->GetTransform());
     overlay_layer.SetAlpha(layer->GetAlpha());
@@ -324,20 +648,120 @@ bool InternalDisplay::Present(
     overlay_layer.SetIndex(layer_index);
     overlay_layer.SetAcquireFence(layer->acquire_fence.Release());
     overlay_layer.SetReleaseFence(layer->release_fence.Release());
-    layers_rects.emplace_back(layer->GetDisplayFrame());
+    frame->layers_rects.emplace_back(layer->GetDisplayFrame());
   }
 
-  // Reset any Display Manager and Compositor state.
-  if (!display_plane_manager_->BeginUpdate(layers, &buffer_handler_)) {
-    ETRACE("Failed to import needed buffers in DisplayManager.");
-    return false;
+  // With the present worker, composition happens later and all layers are
+  // released on flip.
+  std::vector<bool> gpu_only_layers(size, false);
+  if (!present_worker_) {
+    if (!ComposeFrame(frame.get())) {
+      RestorePendingOperations(frame.get());
+      std::lock_guard<std::mutex> queue_guard(queue_lock_);
+      coordinator_->SetWorkQueued(crtc_id_, queued_frame_ || cursor_.dirty);
+      content_.clear();
+      return false;
+    }
+
+    if (frame->gpu_fence.get() >= 0) {
+      for (DisplayPlaneState &plane : frame->composition_planes) {
+        if (plane.GetCompositionState() != DisplayPlaneState::State::kRender)
+          continue;
+
+        for (size_t layer_index : plane.source_layers()) {
+          if (layer_index < size)
+            gpu_only_layers[layer_index] = true;
+        }
+      }
+    }
+  }
+
+  for (size_t layer_index = 0; layer_index < size; layer_index++) {
+    HwcLayer *layer = source_layers.at(layer_index);
+    // The previous buffer was only read by GPU composition, it can be
+    // released as soon as that is done rather than on the next flip.
+    int release_fence = layer->gpu_read_fence.Release();
+    if (release_fence < 0)
+      release_fence = sync_timeline_.CreateFence(frame->sync_point);
+
+    int ret = layer->release_fence.Reset(release_fence);
+    if (ret < 0)
+      ETRACE("Failed to create fence for layer, error: %s", PRINTERROR());
+
+    if (gpu_only_layers[layer_index])
+      layer->gpu_read_fence.Reset(dup(frame->gpu_fence.get()));
+  }
+
+  if (present_worker_) {
+    std::lock_guard<std::mutex> present_guard(present_lock_);
+    // Like a replaced queued frame, the fences of a dropped request are
+    // signalled along with the next flip.
+    if (pending_present_) {
+      ICOMPOSITORTRACE("Replacing pending present with a newer one.");
+      frame->pending_operations |= pending_present_->pending_operations;
+    }
+
+    pending_present_.swap(frame);
+    present_cond_.notify_all();
+  } else {
+    QueueFrame(std::move(frame));
   }
 
-  DisplayPlaneStateList current_composition_planes;
+  // The retire fence returned here is for the last frame. Use the out fence
+  // of the display engine if that frame has been committed by now. If it is
+  // still queued or got replaced, fall back to its sync point, which is
+  // signalled once it or a newer frame is flipped.
+  if (retire_sync_point_) {
+    int fence = -1;
+    {
+      std::lock_guard<std::mutex> queue_guard(queue_lock_);
+      if (out_fence_sync_point_ == retire_sync_point_ && out_fence_.get() >= 0)
+        fence = dup(out_fence_.get());
+    }
+
+    if (fence < 0)
+      fence = sync_timeline_.CreateFence(retire_sync_point_);
+
+    *retire_fence = fence;
+  }
+
+  retire_sync_point_ = sync_point;
+  if (!present_worker_)
+    compositor_.UpdateSurfacePool();
+
+  return true;
+}
+
+bool InternalDisplay::ComposeFrame(QueuedFrame *frame) {
+  std::vector<OverlayLayer> &layers = frame->layers;
+  size_t size = layers.size();
+  DisplayPlaneStateList &current_composition_planes =
+      frame->composition_planes;
   bool render_layers;
-  // Validate Overlays and Layers usage.
-  std::tie(render_layers, current_composition_planes) =
-      display_plane_manager_->ValidateLayers(layers);
+  if (frame->width != compositor_width_ ||
+      frame->height != compositor_height_) {
+    compositor_.Init(&buffer_handler_, frame->width, frame->height, gpu_fd_);
+    compositor_width_ = frame->width;
+    compositor_height_ = frame->height;
+  }
+
+  {
+    std::lock_guard<std::mutex> commit_guard(commit_lock_);
+    // Reset any Display Manager and Compositor state.
+    if (!display_plane_manager_->BeginUpdate(layers, &buffer_handler_)) {
+      ETRACE("Failed to import needed buffers in DisplayManager.");
+      return false;
+    }
+
+    timeline_.Record(frame->timeline_frame, FrameStage::kImport);
+
+    // Validate Overlays and Layers usage.
+    std::tie(render_layers, current_composition_planes) =
+        display_plane_manager_->ValidateLayers(layers);
+    timeline_.Record(frame->timeline_frame, FrameStage::kValidate);
+    timeline_.SetTestCommits(frame->timeline_frame,
+                             display_plane_manager_->GetTestCommitCount());
+  }
 
   DUMP_CURRENT_COMPOSITION_PLANES();
 
@@ -348,72 +772,286 @@ bool InternalDisplay::Present(
     }
 
     // Prepare for final composition.
-    if (!compositor_.Draw(current_composition_planes, layers, layers_rects)) {
-      ETRACE("Failed to prepare for the frame composition ret=%d", ret);
+    if (!compositor_.Draw(current_composition_planes, layers,
+                          frame->layers_rects)) {
+      ETRACE("Failed to prepare for the frame composition.");
       return false;
     }
-  }
 
-  // Do the actual commit.
-  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+    timeline_.Record(frame->timeline_frame, FrameStage::kCompositionSubmit);
+    // Compositor appends the layer it rendered into.
+    if (layers.size() > size) {
+      int gpu_fence = layers.back().GetAcquireFence();
+      if (gpu_fence > 0)
+        frame->gpu_fence.Reset(dup(gpu_fence));
+    }
+  }
 
-  if (!pset) {
+  frame->pset.reset(drmModeAtomicAlloc());
+  if (!frame->pset) {
     ETRACE("Failed to allocate property set %d", -ENOMEM);
     return false;
   }
 
-  uint64_t fence = 0;
-  bool needs_modeset = pending_operations_ & kModeset;
-  if (!ApplyPendingModeset(pset.get(), &fence)) {
+  // Some kernels need a modeset to toggle adaptive sync, allow it only then
+  // as such a commit blocks.
+  uint32_t operations = frame->pending_operations;
+  frame->needs_modeset = operations & kModeset;
+  if (!frame->needs_modeset && (operations & kVariableRefresh))
+    frame->needs_modeset = !CanToggleVariableRefresh(frame->vrr_enable);
+  frame->mode_change =
+      frame->needs_modeset || (operations & (kModeset | kModeSwitch));
+  if (!ApplyPendingModeset(frame)) {
     ETRACE("Failed to Modeset");
     return false;
   }
 
-  for (size_t layer_index = 0; layer_index < size; layer_index++) {
-    HwcLayer *layer = source_layers.at(layer_index);
-    int ret =
-        layer->release_fence.Reset(sync_object->CreateNextTimelineFence());
-    if (ret < 0)
-      ETRACE("Failed to create fence for layer, error: %s", PRINTERROR());
+  // Surfaces rendered for this frame are on screen till the next one flips.
+  // Should this frame be replaced or dropped, that flip also ends the scan
+  // out of whatever is on screen now.
+  if (render_layers)
+    compositor_.EndFrame(sync_timeline_.CreateFence(frame->sync_point + 1));
+
+  return true;
+}
+
+void InternalDisplay::QueueFrame(std::unique_ptr<QueuedFrame> frame) {
+  std::unique_lock<std::mutex> queue_lock(queue_lock_);
+  // A frame carrying a new mode can't be replaced, wait for CommitThread
+  // to pick it up.
+  queue_cond_.wait(queue_lock, [this] {
+    return !queued_frame_ || !queued_frame_->mode_change;
+  });
+  if (queued_frame_)
+    ICOMPOSITORTRACE("Replacing queued frame with a newer one.");
+
+  // The fences of any frame we replace here are signalled along with the
+  // next flip, as its sync point precedes ours.
+  queued_frame_.swap(frame);
+  coordinator_->SetWorkQueued(crtc_id_, true);
+  queue_cond_.notify_all();
+  queue_lock.unlock();
+
+  // Operations of a replaced frame, such as an adaptive sync toggle, go
+  // with the next one.
+  if (frame)
+    RestorePendingOperations(frame.get());
+}
+
+bool InternalDisplay::SetVariableRefresh(bool enable) {
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  if (enable && !vrr_capable_)
+    return false;
+
+  if (vrr_requested_ != enable) {
+    vrr_requested_ = enable;
+    pending_operations_ |= kVariableRefresh;
   }
 
-  PageFlipState *state =
-      new PageFlipState(sync_object.release(), &flip_handler_, pipe_);
-  bool succesful_commit = true;
+  return true;
+}
+
+void InternalDisplay::SetCompositionMemoryBudget(uint32_t budget_mb) {
+  compositor_.SetMemoryBudget(static_cast<uint64_t>(budget_mb) << 20);
+}
+
+bool InternalDisplay::EnableIdleDownclock() {
+  idle_downclock_ = true;
+  return true;
+}
+
+bool InternalDisplay::IsSameContent(
+    const std::vector<HwcLayer *> &source_layers) {
+  {
+    std::lock_guard<std::mutex> queue_guard(queue_lock_);
+    if (content_lost_)
+      return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
+    if (pending_operations_ != kNone || is_powered_off_)
+      return false;
+  }
+
+  if (source_layers.size() != content_.size())
+    return false;
+
+  for (size_t i = 0; i < content_.size(); i++) {
+    const HwcLayer *layer = source_layers[i];
+    const LayerContent &content = content_[i];
+    // An acquire fence comes with a buffer the producer rendered into.
+    if (layer->acquire_fence.get() >= 0 ||
+        layer->GetNativeHandle() != content.handle ||
+        layer->GetTransform() != content.transform ||
+        layer->GetAlpha() != content.alpha ||
+        layer->GetBlending() != content.blending ||
+        !(layer->GetSourceCrop() == content.source_crop) ||
+        !(layer->GetDisplayFrame() == content.display_frame))
+      return false;
+  }
+
+  return true;
+}
+
+void InternalDisplay::SaveContent(
+    const std::vector<HwcLayer *> &source_layers) {
+  {
+    std::lock_guard<std::mutex> queue_guard(queue_lock_);
+    content_lost_ = false;
+  }
+
+  content_.resize(source_layers.size());
+  for (size_t i = 0; i < source_layers.size(); i++) {
+    const HwcLayer *layer = source_layers[i];
+    LayerContent &content = content_[i];
+    content.handle = layer->GetNativeHandle();
+    content.transform = layer->GetTransform();
+    content.alpha = layer->GetAlpha();
+    content.blending = layer->GetBlending();
+    content.source_crop = layer->GetSourceCrop();
+    content.display_frame = layer->GetDisplayFrame();
+  }
+}
+
+bool InternalDisplay::IsIdle() const {
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  return idle_;
+}
+
+bool InternalDisplay::EnterIdleMode() {
+  IDISPLAYMANAGERTRACE("Display %d is idle.", pipe_);
+  bool vrr_active;
+  {
+    std::lock_guard<std::mutex> queue_guard(queue_lock_);
+    vrr_active = vrr_active_;
+  }
+
+  // Shared planes go to displays which still have new content. Handing
+  // them over takes a frame without them.
+  bool release_planes = false;
+  if (allocator_) {
+    allocator_->SetIdle(pipe_, true);
+    release_planes = allocator_->HasPlanesToRelease(pipe_);
+  }
+
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  idle_ = true;
+  idle_mode_ = config_;
+  // The panel already slows down on its own with adaptive sync.
+  if (!idle_downclock_ || vrr_active)
+    return release_planes;
+
+  FindDownclockMode();
+  idle_mode_ = downclock_mode_;
+  if (idle_mode_ == config_)
+    return release_planes;
+
+  IDISPLAYMANAGERTRACE("Idle display %d switching to %f Hz.", pipe_,
+                       downclock_refresh_);
+  pending_operations_ |= kModeSwitch;
+  // Vsync keeps following the panel, while the reported vsync period stays
+  // the one of config_. Nothing is rendered till new content brings the
+  // active mode back.
+  flip_handler_.Init(downclock_refresh_, this);
+  return true;
+}
+
+void InternalDisplay::LeaveIdleMode() {
+  std::lock_guard<std::mutex> mode_guard(mode_lock_);
+  if (!idle_)
+    return;
+
+  idle_ = false;
+  if (allocator_)
+    allocator_->SetIdle(pipe_, false);
+
+  if (idle_mode_ == config_)
+    return;
+
+  // The frame bringing new content restores the active mode.
+  pending_operations_ |= kModeSwitch;
+  flip_handler_.Init(refresh_, this);
+}
+
+bool InternalDisplay::EnablePresentWorker() {
+  if (present_worker_)
+    return true;
+
+  if (!present_thread_.Init(this))
+    return false;
+
+  present_worker_ = true;
+  return true;
+}
+
+void InternalDisplay::HandlePresentRequest() {
+  std::unique_ptr<QueuedFrame> frame;
+  {
+    std::unique_lock<std::mutex> present_lock(present_lock_);
+    present_cond_.wait(present_lock, [this] {
+      return present_thread_.IsExiting() || pending_present_ ||
+             surface_pool_update_;
+    });
+
+    if (present_thread_.IsExiting())
+      return;
+
+    surface_pool_update_ = false;
+    frame = std::move(pending_present_);
+  }
+
+  if (!frame) {
+    compositor_.UpdateSurfacePool();
+    return;
+  }
+
+  if (!ComposeFrame(frame.get())) {
+    ETRACE("Failed to compose frame of sync point %d.", frame->sync_point);
+    RestorePendingOperations(frame.get());
+    std::lock_guard<std::mutex> queue_guard(queue_lock_);
+    coordinator_->SetWorkQueued(crtc_id_, queued_frame_ || cursor_.dirty);
+    content_lost_ = true;
+    return;
+  }
+
+  QueueFrame(std::move(frame));
+  compositor_.UpdateSurfacePool();
+}
+
+bool InternalDisplay::CommitFrame(QueuedFrame *frame) {
+  CTRACE();
+  std::lock_guard<std::mutex> commit_guard(commit_lock_);
+  PageFlipState *state = new PageFlipState(&sync_timeline_, frame->sync_point,
+                                           &flip_handler_, pipe_);
 #ifdef USE_DRM_ATOMIC
-  if (display_plane_manager_->CommitFrameAtomic(
-          current_composition_planes, pset.get(), needs_modeset, state)) {
-    display_plane_manager_->EndUpdate(pset.get());
-  } else {
+  if (!display_plane_manager_->CommitFrameAtomic(
+          frame->composition_planes, frame->pset.get(), frame->needs_modeset,
+          state)) {
+    ICOMPOSITORTRACE("Failed to commit frame, dropping it.");
+    state->Discard();
     delete state;
-    succesful_commit = false;
+    if (frame->out_fence >= 0)
+      close(frame->out_fence);
+    return false;
   }
+
+  timeline_.Record(frame->timeline_frame, FrameStage::kCommit);
+  display_plane_manager_->EndUpdate(frame->pset.get());
 #else
-  display_plane_manager_->CommitFrame(layers, state);
+  display_plane_manager_->CommitFrame(frame->layers, state);
+  timeline_.Record(frame->timeline_frame, FrameStage::kCommit);
   display_plane_manager_->EndUpdate();
 #endif
 
-  if (render_layers)
-    compositor_.EndFrame(succesful_commit);
-
-  // We should fail only with EBUSY error here. Remove this
-  // once we have support to queue commit requests.
-  if (!succesful_commit) {
-    ICOMPOSITORTRACE("Skipped frame as we have pending page flip.");
-    for (size_t layer_index = 0; layer_index < size; layer_index++) {
-      HwcLayer *layer = source_layers.at(layer_index);
-      layer->release_fence.Reset(-1);
-    }
-    return true;
-  }
-
-  if (fence > 0)
-    out_fence_.Reset(fence);
+  std::lock_guard<std::mutex> queue_guard(queue_lock_);
+  if (frame->pending_operations & kVariableRefresh)
+    vrr_active_ = frame->vrr_enable;
 
-  // The retire fence returned here is for the last frame, so return it and
-  // promote the next retire fence
-  *retire_fence = retire_fence_.Release();
-  retire_fence_ = std::move(next_retire_fence_);
+  if (frame->out_fence >= 0) {
+    out_fence_.Reset(frame->out_fence);
+    out_fence_sync_point_ = frame->sync_point;
+  }
 
   return true;
 }
@@ -427,4 +1065,304 @@ void InternalDisplay::VSyncControl(bool enabled) {
   flip_handler_.VSyncControl(enabled);
 }
 
+bool InternalDisplay::SetCursorPosition(HWCNativeHandle handle, int32_t x,
+                                        int32_t y) {
+  CTRACE();
+#ifdef USE_DRM_ATOMIC
+  {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
+    // Modeset needs a full frame.
+    if (is_powered_off_ || pending_operations_ & kModeset)
+      return false;
+  }
+
+  std::lock_guard<std::mutex> queue_guard(queue_lock_);
+  // Only the latest position is kept, CommitThread commits it once no flip
+  // is pending and no frame is queued.
+  cursor_.handle = handle;
+  cursor_.x = x;
+  cursor_.y = y;
+  cursor_.dirty = true;
+  coordinator_->SetWorkQueued(crtc_id_, true);
+  queue_cond_.notify_all();
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool InternalDisplay::CommitFrameRepeat() {
+  CTRACE();
+  std::lock_guard<std::mutex> commit_guard(commit_lock_);
+  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+  if (!pset) {
+    ETRACE("Failed to allocate property set %d", -ENOMEM);
+    return false;
+  }
+
+  // Drivers latch a flip only for a plane update. Flipping to the buffer on
+  // screen already starts a new refresh without changing the content.
+  PageFlipState *state = new PageFlipState(NULL, 0, &flip_handler_, pipe_);
+  if (!display_plane_manager_->CommitFrameRepeat(pset.get(), state)) {
+    delete state;
+    return false;
+  }
+
+  return true;
+}
+
+bool InternalDisplay::CommitCursor(const CursorState &cursor) {
+  CTRACE();
+  std::lock_guard<std::mutex> commit_guard(commit_lock_);
+  PageFlipState *state = new PageFlipState(NULL, 0, &flip_handler_, pipe_);
+  if (!display_plane_manager_->CommitCursorUpdate(
+          cursor.handle, cursor.x, cursor.y, &buffer_handler_, state)) {
+    IDISPLAYMANAGERTRACE("Cursor fast path not possible, needs full frame.");
+    delete state;
+    return false;
+  }
+
+  return true;
+}
+
+void InternalDisplay::PageFlipCompleted(int64_t timestamp) {
+  uint64_t flip_frame;
+  ScopedFd gpu_fence;
+  {
+    std::lock_guard<std::mutex> queue_guard(queue_lock_);
+    flip_pending_ = false;
+    last_flip_ns_ = timestamp;
+    HWC_TRACE_COUNTER("FlipPending", pipe_, 0);
+    flip_frame = flip_frame_;
+    flip_frame_ = 0;
+    gpu_fence.Reset(flip_gpu_fence_.Release());
+    queue_cond_.notify_all();
+  }
+
+  // Shared planes the frame stopped using are free for other pipes now.
+  if (allocator_)
+    allocator_->FrameFlipped(pipe_);
+
+  timeline_.Record(flip_frame, FrameStage::kFlip, timestamp);
+  // The flip waited for composition, so the fence has signalled by now.
+  if (gpu_fence.get() >= 0) {
+    timeline_.Record(flip_frame, FrameStage::kCompositionDone,
+                     NativeSync::GetSignalTime(gpu_fence.get()));
+  }
+}
+
+void InternalDisplay::GetFrameTimings(uint32_t count,
+                                      std::vector<FrameTiming> *frames) {
+  timeline_.GetFrames(count, frames);
+}
+
+void InternalDisplay::Dump(std::ostringstream *out) {
+  {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
+    *out << "  InternalDisplay-" << connector_ << " " << width_ << "x"
+         << height_ << "@" << refresh_ << " pipe " << pipe_
+         << (is_powered_off_ ? " off" : " on") << "\n";
+  }
+  timeline_.Dump(16, out);
+
+  RendererStatistics stats;
+  if (compositor_.GetStatistics(&stats)) {
+    *out << "  GPU composition, " << stats.frames << " frames: mean "
+         << stats.mean_gpu_ms << "ms p99 " << stats.p99_gpu_ms << "ms, "
+         << stats.mean_pixels << " pixels and " << stats.mean_regions
+         << " regions per frame\n";
+  }
+}
+
+void InternalDisplay::SetVBlankLatchMargin(uint32_t margin_us) {
+  std::lock_guard<std::mutex> queue_guard(queue_lock_);
+  latch_margin_ns_ = static_cast<int64_t>(margin_us) * 1000;
+}
+
+void InternalDisplay::WaitForLatchPoint(
+    std::unique_lock<std::mutex> &queue_lock) {
+  // In adaptive sync mode the panel refreshes as the frame arrives, waiting
+  // would only add latency.
+  if (!latch_margin_ns_ || vrr_active_ || queued_frame_->needs_modeset)
+    return;
+
+  int64_t now = GetMonotonicTimeNs();
+  int64_t vblank = flip_handler_.GetNextVBlankTime(now);
+  int64_t latch = vblank - latch_margin_ns_;
+  if (!vblank || latch <= now)
+    return;
+
+  // Page flip timestamps and steady_clock are both CLOCK_MONOTONIC. Frames
+  // presented till the latch point replace the queued one; a modeset frame
+  // is committed right away.
+  HWC_TRACE_SLICE("WaitForLatchPoint");
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::nanoseconds(latch - now);
+  queue_cond_.wait_until(queue_lock, deadline,
+                         [this] { return queued_frame_->needs_modeset; });
+}
+
+int64_t InternalDisplay::GetFrameRepeatTime(int64_t now) const {
+  if (!vrr_active_ || flip_pending_ || !vrr_max_frame_ns_ || !last_flip_ns_ ||
+      present_interval_ns_ <= vrr_max_frame_ns_)
+    return 0;
+
+  // Once content stops updating the panel holding the frame is fine.
+  if (now - last_present_ns_ > 2 * present_interval_ns_)
+    return 0;
+
+  // Frames arrive slower than the panel can hold them. Split the interval
+  // into refreshes it can hold, so the next frame lands on a boundary
+  // rather than behind a refresh the panel had to start on its own.
+  int64_t repeats =
+      (present_interval_ns_ + vrr_max_frame_ns_ - 1) / vrr_max_frame_ns_;
+  return last_flip_ns_ + present_interval_ns_ / repeats;
+}
+
+void InternalDisplay::HandleCommitRequest() {
+  std::unique_ptr<QueuedFrame> frame;
+  CursorState cursor;
+  bool repeat = false;
+  {
+    std::unique_lock<std::mutex> queue_lock(queue_lock_);
+    auto ready = [this] {
+      return commit_thread_.IsExiting() ||
+             (!flip_pending_ && (queued_frame_ || cursor_.dirty));
+    };
+    while (!ready()) {
+      int64_t now = GetMonotonicTimeNs();
+      int64_t repeat_time = GetFrameRepeatTime(now);
+      if (!repeat_time) {
+        queue_cond_.wait(queue_lock);
+      } else if (repeat_time > now) {
+        queue_cond_.wait_for(queue_lock,
+                             std::chrono::nanoseconds(repeat_time - now));
+      } else {
+        repeat = true;
+        break;
+      }
+    }
+
+    if (commit_thread_.IsExiting())
+      return;
+
+    // Frames take priority. The cursor stays dirty as its latest position
+    // might be newer than the one composed in the frame.
+    if (repeat) {
+      flip_frame_ = 0;
+      flip_gpu_fence_.Reset(-1);
+    } else if (queued_frame_) {
+      WaitForLatchPoint(queue_lock);
+      frame = std::move(queued_frame_);
+      flip_frame_ = frame->timeline_frame;
+      flip_gpu_fence_.Reset(frame->gpu_fence.Release());
+    } else {
+      cursor = cursor_;
+      cursor_.dirty = false;
+      flip_frame_ = 0;
+      flip_gpu_fence_.Reset(-1);
+    }
+
+    flip_pending_ = true;
+    HWC_TRACE_COUNTER("FlipPending", pipe_, 1);
+    // Present might be waiting for a modeset frame to leave the queue.
+    queue_cond_.notify_all();
+  }
+
+  bool committed;
+  if (repeat)
+    committed = CommitFrameRepeat();
+  else
+    committed = frame ? CommitFrame(frame.get()) : CommitCursor(cursor);
+
+  if (!committed && frame)
+    RestorePendingOperations(frame.get());
+
+  int release_sync_point = 0;
+  {
+    std::lock_guard<std::mutex> queue_guard(queue_lock_);
+    // Tiles committing next need to wait for us only if there is more to
+    // commit.
+    coordinator_->SetWorkQueued(crtc_id_, queued_frame_ || cursor_.dirty);
+
+    if (committed) {
+      if (frame)
+        failed_commit_ns_ = 0;
+    } else {
+      flip_pending_ = false;
+      int64_t now = GetMonotonicTimeNs();
+      // Don't retry a failed repeat right away.
+      if (repeat)
+        last_flip_ns_ = now;
+
+      if (frame) {
+        content_lost_ = true;
+        // The sync point of a failed frame also covers the buffers on
+        // screen, so it is left to the next flip. Should none come, release
+        // them anyway rather than leaving producers waiting forever.
+        if (!failed_commit_ns_)
+          failed_commit_ns_ = now;
+        else if (now - failed_commit_ns_ > kMaxFailedCommitNs)
+          release_sync_point = frame->sync_point;
+      }
+    }
+  }
+
+  if (release_sync_point) {
+    ETRACE("Commits keep failing, releasing buffers up to sync point %d.",
+           release_sync_point);
+    sync_timeline_.SignalPoint(release_sync_point);
+  }
+}
+
+InternalDisplay::CommitThread::CommitThread() : HWCThread(-8) {
+}
+
+InternalDisplay::CommitThread::~CommitThread() {
+}
+
+bool InternalDisplay::CommitThread::Init(InternalDisplay *display) {
+  display_ = display;
+  if (!InitWorker("CommitThread")) {
+    ETRACE("Failed to initialize commit thread. %s", PRINTERROR());
+    return false;
+  }
+
+  return true;
+}
+
+void InternalDisplay::CommitThread::Routine() {
+  display_->HandleCommitRequest();
+}
+
+void InternalDisplay::CommitThread::HandleExit() {
+  std::lock_guard<std::mutex> queue_guard(display_->queue_lock_);
+  display_->queue_cond_.notify_all();
+}
+
+InternalDisplay::PresentThread::PresentThread() : HWCThread(-8) {
+}
+
+InternalDisplay::PresentThread::~PresentThread() {
+}
+
+bool InternalDisplay::PresentThread::Init(InternalDisplay *display) {
+  display_ = display;
+  if (!InitWorker("PresentThread")) {
+    ETRACE("Failed to initialize present thread. %s", PRINTERROR());
+    return false;
+  }
+
+  return true;
+}
+
+void InternalDisplay::PresentThread::Routine() {
+  display_->HandlePresentRequest();
+}
+
+void InternalDisplay::PresentThread::HandleExit() {
+  std::lock_guard<std::mutex> present_guard(display_->present_lock_);
+  display_->present_cond_.notify_all();
+}
+
 }  // namespace hwcomposer
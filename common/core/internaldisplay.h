@@ -20,24 +20,35 @@
 #include <stdint.h>
 #include <xf86drmMode.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
 #include <drmscopedtypes.h>
 #include <nativedisplay.h>
 #include <nativebufferhandler.h>
 
 #include "compositor.h"
+#include "frametimeline.h"
+#include "hwcthread.h"
+#include "nativesync.h"
+#include "overlaylayer.h"
 #include "pageflipeventhandler.h"
 #include "scopedfd.h"
 
 namespace hwcomposer {
+class CommitCoordinator;
 class DisplayPlaneState;
 class DisplayPlaneManager;
 class GpuDevice;
+class PlaneAllocator;
 struct HwcLayer;
 
 class InternalDisplay : public NativeDisplay {
  public:
   InternalDisplay(uint32_t gpu_fd, NativeBufferHandler &handler,
-                  uint32_t pipe_id, uint32_t crtc_id);
+                  uint32_t pipe_id, uint32_t crtc_id,
+                  CommitCoordinator *coordinator, PlaneAllocator *allocator);
   ~InternalDisplay();
 
   bool Initialize() override;
@@ -53,14 +64,17 @@ class InternalDisplay : public NativeDisplay {
   uint32_t Fd() const override;
 
   int32_t Width() const override {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
     return width_;
   }
 
   int32_t Height() const override {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
     return height_;
   }
 
   int32_t GetRefreshRate() const override {
+    std::lock_guard<std::mutex> mode_guard(mode_lock_);
     return refresh_;
   }
 
@@ -82,6 +96,45 @@ class InternalDisplay : public NativeDisplay {
 
   void VSyncControl(bool enabled) override;
 
+  bool SetCursorPosition(HWCNativeHandle handle, int32_t x,
+                         int32_t y) override;
+
+  void SetVBlankLatchMargin(uint32_t margin_us) override;
+
+  bool EnablePresentWorker() override;
+
+  bool SetVariableRefresh(bool enable) override;
+
+  bool EnableIdleDownclock() override;
+
+  void SetCompositionMemoryBudget(uint32_t budget_mb) override;
+
+  void GetFrameTimings(uint32_t count,
+                       std::vector<FrameTiming> *frames) override;
+
+  void Dump(std::ostringstream *out) override;
+
+  // Called from DisplayManager thread once a commit of this display has
+  // been latched by the hardware at timestamp.
+  void PageFlipCompleted(int64_t timestamp);
+
+  // Software vsync timer, polled by DisplayManager.
+  int GetVSyncTimerFd() const {
+    return flip_handler_.GetVSyncTimerFd();
+  }
+
+  void HandleVSyncTimer() {
+    flip_handler_.HandleVSyncTimer();
+  }
+
+  // Called from CommitThread. Blocks till there is a frame or cursor update
+  // to commit and no page flip is pending, then commits it.
+  void HandleCommitRequest();
+
+  // Called from PresentThread. Blocks till a frame is presented, then
+  // composes and queues it for commit.
+  void HandlePresentRequest();
+
  protected:
   uint32_t CrtcId() const override {
     return crtc_id_;
@@ -99,46 +152,277 @@ class InternalDisplay : public NativeDisplay {
   void ShutDown() override;
 
  private:
-  enum PendingModeset { kNone = 0, kDpms = 1 << 0, kModeset = 1 << 1 };
+  // kModeSwitch changes the mode without a full modeset, which the kernel
+  // allows when only the timings of the current resolution change.
+  enum PendingModeset {
+    kNone = 0,
+    kDpms = 1 << 0,
+    kModeset = 1 << 1,
+    kModeSwitch = 1 << 2,
+    kVariableRefresh = 1 << 3
+  };
+
+  struct QueuedFrame;
 
-  bool ApplyPendingModeset(drmModeAtomicReqPtr property_set,
-                           uint64_t *out_fence);
+  // Applies the operations snapshot into frame. frame->out_fence needs to
+  // stay valid till the property set is committed.
+  bool ApplyPendingModeset(QueuedFrame *frame);
+
+  // Returns true if the kernel accepts setting VRR_ENABLED to enable without
+  // a full modeset.
+  bool CanToggleVariableRefresh(bool enable) const;
+
+  // Called with mode_lock_ held. Moves the pending operations and the mode
+  // they apply to into frame.
+  void TakePendingOperations(QueuedFrame *frame);
+
+  // Called if frame was dropped before its operations took effect.
+  void RestorePendingOperations(const QueuedFrame *frame);
 
   bool GetDrmObjectProperty(const char *name,
                             const ScopedDrmObjectPropertyPtr &props,
                             uint32_t *id) const;
 
-  void AddFenceToRetireFence(int fd, NativeSync *sync);
+  // Returns the tile group id of a tiled connector, 0 otherwise.
+  uint32_t GetTileGroup(const ScopedDrmObjectPropertyPtr &props) const;
+
+  // Makes modes_[config] the current mode.
+  void UpdateMode(uint32_t config);
+
+  // Returns the MODE_ID blob of modes_[config], creating it on first use.
+  uint32_t GetModeBlob(uint32_t config);
+
+  // Returns true if the kernel accepts switching to modes_[config] without
+  // a full modeset.
+  bool CanSwitchSeamlessly(uint32_t config);
+
+  // Sets downclock_mode_ and downclock_refresh_ unless known already.
+  void FindDownclockMode();
+
+  void ReleaseModeBlobs();
+
+  // Returns true if the connector supports adaptive sync. min_refresh is
+  // set to the lowest rate of its range from the EDID, 0 if unknown.
+  bool GetVariableRefreshRange(const ScopedDrmObjectPropertyPtr &props,
+                               uint32_t *min_refresh) const;
+
+  // Returns true if source_layers show the same buffers with the same
+  // geometry as the last frame with new content.
+  bool IsSameContent(const std::vector<HwcLayer *> &source_layers);
+  void SaveContent(const std::vector<HwcLayer *> &source_layers);
+
+  bool IsIdle() const;
+
+  // Called once the screen has been idle for a while. Returns true if a
+  // frame is needed to switch to a lower refresh rate or to hand over shared
+  // planes.
+  bool EnterIdleMode();
+  void LeaveIdleMode();
+
+  // Called with queue_lock_ held. Returns the time at which the last frame
+  // should be scanned out again for low framerate compensation, 0 if not
+  // needed.
+  int64_t GetFrameRepeatTime(int64_t now) const;
+
+  void WaitForLatchPoint(std::unique_lock<std::mutex> &queue_lock);
+
+  // Layer state compared by the idle detector.
+  struct LayerContent {
+    HWCNativeHandle handle;
+    uint32_t transform;
+    uint8_t alpha;
+    HWCBlending blending;
+    HwcRect<float> source_crop;
+    HwcRect<int> display_frame;
+  };
+
+  struct CursorState {
+    HWCNativeHandle handle = NULL;
+    int32_t x = 0;
+    int32_t y = 0;
+    bool dirty = false;
+  };
+
+  // Everything needed to commit a composed frame, owned by the queue till
+  // the frame is committed or replaced by a newer one.
+  struct QueuedFrame {
+    std::vector<OverlayLayer> layers;
+    DisplayPlaneStateList composition_planes;
+    ScopedDrmAtomicReqPtr pset;
+    // Point on sync_timeline_ release and retire fences of this frame are
+    // created for.
+    int sync_point = 0;
+    // Written by the kernel through OUT_FENCE_PTR on commit.
+    int32_t out_fence = -1;
+    // Snapshot of the pending operations and the mode state they apply,
+    // taken by Present so composition and commit never read live state.
+    uint32_t pending_operations = kNone;
+    uint32_t mode_blob = 0;
+    uint32_t connector = 0;
+    uint32_t dpms_mode = DRM_MODE_DPMS_ON;
+    bool vrr_enable = false;
+    int32_t width = 0;
+    int32_t height = 0;
+    bool needs_modeset = false;
+    // Carries a new mode, with or without a full modeset. Such a frame is
+    // never replaced by a newer one.
+    bool mode_change = false;
+    uint64_t timeline_frame = 0;
+    // Signalled once GPU composition of this frame is done.
+    ScopedFd gpu_fence;
+    std::vector<HwcRect<int>> layers_rects;
+  };
+
+  class CommitThread : public HWCThread {
+   public:
+    CommitThread();
+    ~CommitThread();
+
+    bool Init(InternalDisplay *display);
+
+   protected:
+    void Routine() override;
+    void HandleExit() override;
+
+   private:
+    InternalDisplay *display_ = NULL;
+  };
+
+  class PresentThread : public HWCThread {
+   public:
+    PresentThread();
+    ~PresentThread();
+
+    bool Init(InternalDisplay *display);
+
+   protected:
+    void Routine() override;
+    void HandleExit() override;
+
+   private:
+    InternalDisplay *display_ = NULL;
+  };
+
+  // Imports, validates and composes frame and prepares its property set.
+  bool ComposeFrame(QueuedFrame *frame);
+  void QueueFrame(std::unique_ptr<QueuedFrame> frame);
+  bool CommitFrame(QueuedFrame *frame);
+  bool CommitCursor(const CursorState &cursor);
+  // Starts a new refresh of the frame on screen, see GetFrameRepeatTime.
+  bool CommitFrameRepeat();
 
   NativeBufferHandler &buffer_handler_;
+  CommitCoordinator *coordinator_;
+  PlaneAllocator *allocator_;
   Compositor compositor_;
   PageFlipEventHandler flip_handler_;
   drmModeModeInfo mode_;
+  // Modes of the connector, configs index into these.
+  std::vector<drmModeModeInfo> modes_;
+  // MODE_ID blobs of modes_, 0 till first used.
+  std::vector<uint32_t> mode_blobs_;
+  uint32_t config_ = 0;
   uint32_t frame_;
   uint32_t dpms_prop_;
   uint32_t crtc_prop_;
   uint32_t active_prop_;
   uint32_t mode_id_prop_;
   uint32_t out_fence_ptr_prop_;
+  uint32_t vrr_enabled_prop_ = 0;
   uint32_t crtc_id_;
   uint32_t pipe_;
   uint32_t dpms_mode_ = DRM_MODE_DPMS_ON;
   uint32_t connector_;
+  // Set from any thread, taken over by the next frame in Present.
   uint32_t pending_operations_ = kNone;
-  uint32_t blob_id_ = 0;
-  uint32_t old_blob_id_ = 0;
   int32_t width_;
   int32_t height_;
   int32_t dpix_;
   int32_t dpiy_;
+  uint32_t mm_width_ = 0;
+  uint32_t mm_height_ = 0;
   uint32_t gpu_fd_;
   bool is_connected_;
   bool is_powered_off_;
+  bool vrr_capable_ = false;
+  bool vrr_requested_ = false;
   float refresh_;
-  ScopedFd retire_fence_;
-  ScopedFd next_retire_fence_;
-  ScopedFd out_fence_ = -1;
+  // Longest time the panel holds a frame in adaptive sync mode.
+  int64_t vrr_max_frame_ns_ = 0;
+  // Sync point of the last frame presented, its retire fence is returned by
+  // the next Present.
+  int retire_sync_point_ = 0;
+  // Layers of the last frame with new content and when it was presented.
+  std::vector<LayerContent> content_;
+  int64_t content_ns_ = 0;
+  // Set while no new content arrived for kIdleTimeoutNs. idle_mode_ is the
+  // mode used meanwhile, which is config_ unless downclocking.
+  bool idle_ = false;
+  bool idle_downclock_ = false;
+  uint32_t idle_mode_ = 0;
+  // Lowest refresh mode config_ can switch to seamlessly and its rate.
+  // Found with TEST_ONLY commits the first time the display idles in
+  // config_, -1 till then.
+  int32_t downclock_mode_ = -1;
+  float downclock_refresh_ = 0;
+  // Out fence of the last frame committed and its sync point.
+  ScopedFd out_fence_;
+  int out_fence_sync_point_ = 0;
+  // Size the compositor was last set up for, only used by the thread
+  // composing frames.
+  int32_t compositor_width_ = 0;
+  int32_t compositor_height_ = 0;
   std::unique_ptr<DisplayPlaneManager> display_plane_manager_;
+  FrameTimeline timeline_;
+  // Signalled up to the sync point of each frame as it flips. A dropped
+  // frame's point gets signalled along with the next flip.
+  NativeSync sync_timeline_;
+  int sync_point_ = 0;
+  CommitThread commit_thread_;
+  // Protects pending_operations_, the connector and mode state, idle_,
+  // idle_mode_, downclock_mode_, is_powered_off_, dpms_mode_, vrr_capable_
+  // and vrr_requested_. They are changed by the HWC2 and DisplayManager
+  // threads while frames are composed by PresentThread.
+  mutable std::mutex mode_lock_;
+  // Serialises access to display_plane_manager_ between Present and
+  // CommitThread.
+  std::mutex commit_lock_;
+  // Protects queued_frame_, cursor_, flip_pending_, flip_frame_,
+  // flip_gpu_fence_, latch_margin_ns_, failed_commit_ns_, out_fence_,
+  // out_fence_sync_point_ and the adaptive sync state below.
+  std::mutex queue_lock_;
+  std::condition_variable queue_cond_;
+  // At most one frame waits here while another one is pending flip. A newer
+  // frame replaces it.
+  std::unique_ptr<QueuedFrame> queued_frame_;
+  CursorState cursor_;
+  bool flip_pending_ = false;
+  // Timeline frame pending flip and the fence of its GPU composition.
+  uint64_t flip_frame_ = 0;
+  ScopedFd flip_gpu_fence_;
+  int64_t latch_margin_ns_;
+  // Adaptive sync is enabled on the CRTC.
+  bool vrr_active_ = false;
+  // Arrival time of the last presented frame and the average interval
+  // between frames, which drive low framerate compensation.
+  int64_t last_present_ns_ = 0;
+  int64_t present_interval_ns_ = 0;
+  int64_t last_flip_ns_ = 0;
+  // A frame got dropped, the screen might not show content_.
+  bool content_lost_ = false;
+  // When the first of the frame commits failing since the last successful
+  // one was tried, 0 if the last one succeeded.
+  int64_t failed_commit_ns_ = 0;
+  // Set once presents are handed to present_thread_.
+  bool present_worker_ = false;
+  PresentThread present_thread_;
+  std::mutex present_lock_;
+  std::condition_variable present_cond_;
+  // Latest frame waiting for present_thread_, protected by present_lock_.
+  std::unique_ptr<QueuedFrame> pending_present_;
+  // Set by idle presents for present_thread_ to age the surface pool,
+  // protected by present_lock_.
+  bool surface_pool_update_ = false;
 };
 
 }  // namespace hwcomposer
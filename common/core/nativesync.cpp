@@ -18,6 +18,8 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+
 #include <sw_sync.h>
 #include <sync/sync.h>
 
@@ -29,8 +31,10 @@ NativeSync::NativeSync() {
 }
 
 NativeSync::~NativeSync() {
-  if (timeline_fd_.get() >= 0)
+  if (timeline_fd_.get() >= 0) {
+    std::lock_guard<std::mutex> lock(lock_);
     SignalCompositionDone();
+  }
 }
 
 bool NativeSync::Init() {
@@ -44,14 +48,51 @@ bool NativeSync::Init() {
 }
 
 int NativeSync::CreateNextTimelineFence() {
+  std::lock_guard<std::mutex> lock(lock_);
   ++timeline_;
   return sw_sync_fence_create(timeline_fd_.get(), "NativeSync", timeline_);
 }
 
+int NativeSync::CreateFence(int point) {
+  std::lock_guard<std::mutex> lock(lock_);
+  timeline_ = std::max(timeline_, point);
+  return sw_sync_fence_create(timeline_fd_.get(), "NativeSync", point);
+}
+
+int NativeSync::SignalPoint(int point) {
+  std::lock_guard<std::mutex> lock(lock_);
+  return IncreaseTimelineToPoint(point);
+}
+
 int NativeSync::MergeFence(int fence1, int fence2) {
   return sync_merge("MergeFence", fence1, fence2);
 }
 
+int64_t NativeSync::GetSignalTime(int fence) {
+  struct sync_fence_info_data *info = sync_fence_info(fence);
+  if (!info)
+    return 0;
+
+  int64_t timestamp = 0;
+  struct sync_pt_info *pt_info = NULL;
+  while ((pt_info = sync_pt_info(info, pt_info))) {
+    // A fence is signalled once all of its sync points are.
+    if (pt_info->status != 1) {
+      timestamp = 0;
+      break;
+    }
+
+    timestamp = std::max<int64_t>(timestamp, pt_info->timestamp_ns);
+  }
+
+  sync_fence_info_free(info);
+  return timestamp;
+}
+
+bool NativeSync::Wait(int fence, int timeout_ms) {
+  return !sync_wait(fence, timeout_ms);
+}
+
 int NativeSync::IncreaseTimelineToPoint(int point) {
   int timeline_increase = point - timeline_current_;
   if (timeline_increase <= 0)
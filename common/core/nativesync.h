@@ -19,6 +19,8 @@
 
 #include <stdint.h>
 
+#include <mutex>
+
 #include <scopedfd.h>
 
 namespace hwcomposer {
@@ -32,12 +34,26 @@ class NativeSync {
 
   int CreateNextTimelineFence();
 
+  // Creates a fence signalled once the timeline reaches point.
+  int CreateFence(int point);
+
+  // Signals all fences of points up to and including point. Can be called
+  // from a different thread than the one creating fences.
+  int SignalPoint(int point);
+
   int SignalCompositionDone() {
     return IncreaseTimelineToPoint(timeline_);
   }
 
   int MergeFence(int fence1, int fence2);
 
+  // Returns the time (CLOCK_MONOTONIC, in ns) fence got signalled at, or 0 if
+  // it is still pending.
+  static int64_t GetSignalTime(int fence);
+
+  // Waits up to timeout_ms for fence, returns true if it got signalled.
+  static bool Wait(int fence, int timeout_ms);
+
   int GetFd() const {
     return timeline_fd_.get();
   }
@@ -46,6 +62,7 @@ class NativeSync {
   int IncreaseTimelineToPoint(int point);
 
   ScopedFd timeline_fd_;
+  std::mutex lock_;
   int timeline_ = 0;
   int timeline_current_ = 0;
 };
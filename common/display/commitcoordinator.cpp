@@ -0,0 +1,163 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "commitcoordinator.h"
+
+#include <xf86drm.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <drmscopedtypes.h>
+#include <hwctrace.h>
+
+#include "pageflipstate.h"
+
+namespace hwcomposer {
+
+// Members of a sync group present for the same vblank, so their commits
+// arrive close together. Don't hold back a frame longer than this for the
+// others.
+static const int64_t kMergeWindowNs = 2 * 1000 * 1000;
+
+CommitCoordinator::CommitCoordinator(uint32_t gpu_fd) : gpu_fd_(gpu_fd) {
+}
+
+CommitCoordinator::~CommitCoordinator() {
+}
+
+void CommitCoordinator::SetSyncGroup(uint32_t crtc_id, uint32_t group) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (group) {
+    groups_[crtc_id] = group;
+  } else {
+    groups_.erase(crtc_id);
+    queued_.erase(crtc_id);
+  }
+
+  // Group sizes changed, stop waiting for members which might be gone.
+  cond_.notify_all();
+}
+
+void CommitCoordinator::SetWorkQueued(uint32_t crtc_id, bool queued) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (queued) {
+    queued_.insert(crtc_id);
+  } else {
+    queued_.erase(crtc_id);
+    // Members waiting for us can go ahead.
+    cond_.notify_all();
+  }
+}
+
+int CommitCoordinator::Commit(uint32_t crtc_id, drmModeAtomicReqPtr pset,
+                              uint32_t flags, PageFlipState *state) {
+  std::unique_lock<std::mutex> lock(lock_);
+  queued_.erase(crtc_id);
+  auto member = groups_.find(crtc_id);
+  if (member == groups_.end()) {
+    lock.unlock();
+    return drmModeAtomicCommit(gpu_fd_, pset, flags, state);
+  }
+
+  uint32_t group = member->second;
+  Request request;
+  request.crtc_id = crtc_id;
+  request.pset = pset;
+  request.flags = flags;
+  request.state = state;
+  std::vector<Request *> &pending = pending_[group];
+  pending.emplace_back(&request);
+
+  // Only members with work queued which haven't submitted it yet are waited
+  // for. Idle ones, e.g. a tile skipping a frame, would hold back the others
+  // for the whole window.
+  auto group_complete = [this, group, &request] {
+    return request.taken ||
+           std::none_of(
+               groups_.begin(), groups_.end(),
+               [this, group](const std::pair<const uint32_t, uint32_t> &entry) {
+                 return entry.second == group && queued_.count(entry.first);
+               });
+  };
+
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::nanoseconds(kMergeWindowNs);
+  cond_.wait_until(lock, deadline, group_complete);
+  if (request.taken) {
+    // Another member is committing ours along with its own.
+    cond_.wait(lock, [&request] { return request.done; });
+    return request.result;
+  }
+
+  std::vector<Request *> requests;
+  requests.swap(pending_[group]);
+  for (Request *taken : requests)
+    taken->taken = true;
+
+  lock.unlock();
+  CommitRequests(requests);
+  lock.lock();
+
+  for (Request *committed : requests)
+    committed->done = true;
+
+  cond_.notify_all();
+  return request.result;
+}
+
+void CommitCoordinator::CommitRequests(const std::vector<Request *> &requests) {
+  HWC_TRACE_SLICE("MergedCommit");
+  int ret = -1;
+  if (requests.size() > 1) {
+    ScopedDrmAtomicReqPtr merged(drmModeAtomicAlloc());
+    uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+    for (Request *request : requests) {
+      if (merged)
+        drmModeAtomicMerge(merged.get(), request->pset);
+
+      // Block if any of the commits would.
+      if (!(request->flags & DRM_MODE_ATOMIC_NONBLOCK))
+        flags &= ~DRM_MODE_ATOMIC_NONBLOCK;
+
+      flags |= request->flags & DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+
+    // The kernel sends a flip event per CRTC, all carrying the first state.
+    PageFlipState *state = requests.front()->state;
+    for (size_t i = 1; i < requests.size(); ++i)
+      state->AddMergedState(requests[i]->crtc_id, requests[i]->state);
+
+    if (merged)
+      ret = drmModeAtomicCommit(gpu_fd_, merged.get(), flags, state);
+
+    if (ret) {
+      IDISPLAYMANAGERTRACE("Merged commit failed, committing separately. %s",
+                           PRINTERROR());
+      state->ClearMergedStates();
+    }
+  }
+
+  for (Request *request : requests) {
+    if (ret)
+      request->result = drmModeAtomicCommit(gpu_fd_, request->pset,
+                                            request->flags, request->state);
+    else
+      request->result = 0;
+  }
+}
+
+}  // namespace hwcomposer
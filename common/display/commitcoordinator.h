@@ -0,0 +1,84 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef COMMIT_COORDINATOR_H_
+#define COMMIT_COORDINATOR_H_
+
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace hwcomposer {
+
+class PageFlipState;
+
+// Merges atomic commits of CRTCs scanning out in lockstep, e.g. the tiles of
+// one panel, into a single commit so they always flip on the same vblank.
+class CommitCoordinator {
+ public:
+  CommitCoordinator(uint32_t gpu_fd);
+  ~CommitCoordinator();
+
+  // Adds crtc_id to sync group, or removes it from its group if group is 0.
+  void SetSyncGroup(uint32_t crtc_id, uint32_t group);
+
+  // Tells whether crtc_id has a frame or cursor update waiting for commit.
+  // Commit clears the mark, callers set it again if more work is left.
+  void SetWorkQueued(uint32_t crtc_id, bool queued);
+
+  // Same as drmModeAtomicCommit for CRTCs outside any sync group. Otherwise
+  // pset is held till all members of the group with work queued submitted
+  // theirs, or for kMergeWindowNs at most, and all psets collected are
+  // committed at once. Idle members are not waited for.
+  // If that fails, they are committed one by one. The flip event of crtc_id
+  // is delivered to state in any case.
+  int Commit(uint32_t crtc_id, drmModeAtomicReqPtr pset, uint32_t flags,
+             PageFlipState *state);
+
+ private:
+  struct Request {
+    uint32_t crtc_id;
+    drmModeAtomicReqPtr pset;
+    uint32_t flags;
+    PageFlipState *state;
+    int result = 0;
+    // Taken out of pending_ by the thread committing it, which sets done
+    // once result is valid.
+    bool taken = false;
+    bool done = false;
+  };
+
+  // Called without lock_ held, so a blocking commit doesn't stall others.
+  void CommitRequests(const std::vector<Request *> &requests);
+
+  uint32_t gpu_fd_;
+  std::mutex lock_;
+  std::condition_variable cond_;
+  // Sync group of each CRTC which is part of one.
+  std::map<uint32_t, uint32_t> groups_;
+  // Requests waiting to be merged, per sync group.
+  std::map<uint32_t, std::vector<Request *>> pending_;
+  // CRTCs which marked themselves with SetWorkQueued.
+  std::set<uint32_t> queued_;
+};
+
+}  // namespace hwcomposer
+#endif  // COMMIT_COORDINATOR_H_
@@ -47,14 +47,61 @@ bool DisplayPlane::Initialize(uint32_t gpu_fd,
   for (uint32_t i = 0; i < count_props; i++) {
     ScopedDrmPropertyPtr property(
         drmModeGetProperty(gpu_fd, plane_props->props[i]));
-    if (property && !strcmp(property->name, "type")) {
+    if (!property)
+      continue;
+
+    if (!strcmp(property->name, "type")) {
       type_ = plane_props->prop_values[i];
-      break;
+    } else if (!strcmp(property->name, "IN_FORMATS")) {
+      InitializeModifiers(gpu_fd, plane_props->prop_values[i]);
     }
   }
 
   return InitializeProperties(gpu_fd, plane_props);
 }
+
+void DisplayPlane::InitializeModifiers(uint32_t gpu_fd, uint32_t blob_id) {
+  ScopedDrmPropertyBlobPtr blob(drmModeGetPropertyBlob(gpu_fd, blob_id));
+  if (!blob) {
+    ETRACE("Unable to get IN_FORMATS blob for plane %d.", id_);
+    return;
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(blob->data);
+  const drm_format_modifier_blob* header =
+      reinterpret_cast<const drm_format_modifier_blob*>(data);
+  // Don't trust the offsets and counts to stay within the blob.
+  uint32_t length = blob->length;
+  if (length < sizeof(*header) || header->formats_offset > length ||
+      header->modifiers_offset > length ||
+      header->count_formats >
+          (length - header->formats_offset) / sizeof(uint32_t) ||
+      header->count_modifiers > (length - header->modifiers_offset) /
+                                    sizeof(drm_format_modifier)) {
+    ETRACE("Invalid IN_FORMATS blob for plane %d.", id_);
+    return;
+  }
+
+  const uint32_t* formats =
+      reinterpret_cast<const uint32_t*>(data + header->formats_offset);
+  const drm_format_modifier* modifiers =
+      reinterpret_cast<const drm_format_modifier*>(data +
+                                                   header->modifiers_offset);
+  // Each modifier applies to a window of 64 formats starting at offset,
+  // with bit n of formats set if formats[offset + n] supports it.
+  for (uint32_t i = 0; i < header->count_modifiers; i++) {
+    for (uint32_t j = 0; j < 64; j++) {
+      if (!(modifiers[i].formats & (1ULL << j)))
+        continue;
+
+      uint32_t index = modifiers[i].offset + j;
+      if (index >= header->count_formats)
+        break;
+
+      supported_modifiers_.emplace_back(formats[index], modifiers[i].modifier);
+    }
+  }
+}
 #ifdef USE_DRM_ATOMIC
 bool DisplayPlane::UpdateProperties(drmModeAtomicReqPtr /*property_set*/,
                                     uint32_t /*crtc_id*/,
@@ -62,6 +109,17 @@ bool DisplayPlane::UpdateProperties(drmModeAtomicReqPtr /*property_set*/,
   return false;
 }
 
+bool DisplayPlane::UpdateCursorProperties(
+    drmModeAtomicReqPtr /*property_set*/, int32_t /*x*/, int32_t /*y*/,
+    const OverlayBuffer* /*buffer*/) const {
+  return false;
+}
+
+bool DisplayPlane::UpdateFb(drmModeAtomicReqPtr /*property_set*/,
+                            const OverlayBuffer* /*buffer*/) const {
+  return false;
+}
+
 bool DisplayPlane::Disable(drmModeAtomicReqPtr /*property_set*/) {
   return false;
 }
@@ -84,11 +142,12 @@ uint32_t DisplayPlane::type() const {
 
 bool DisplayPlane::ValidateLayer(const OverlayLayer* layer) {
   uint32_t format = layer->GetBuffer()->GetFormat();
+  uint64_t modifier = layer->GetBuffer()->GetModifier();
   if (!IsSupportedFormat(format)) {
     // In case of primary we can fallback to XRGB.
     if (type_ == DRM_PLANE_TYPE_PRIMARY) {
       format = GetFormatForFrameBuffer(format);
-      if (IsSupportedFormat(format)) {
+      if (IsSupportedFormat(format) && IsSupportedModifier(format, modifier)) {
         layer->GetBuffer()->SetRecommendedFormat(format);
         return true;
       }
@@ -99,6 +158,12 @@ bool DisplayPlane::ValidateLayer(const OverlayLayer* layer) {
     return false;
   }
 
+  if (!IsSupportedModifier(format, modifier)) {
+    IDISPLAYMANAGERTRACE(
+        "Layer cannot be supported as modifier is not supported.");
+    return false;
+  }
+
   return CanCompositeLayer(layer);
 }
 
@@ -120,6 +185,21 @@ bool DisplayPlane::IsSupportedFormat(uint32_t format) {
   return false;
 }
 
+bool DisplayPlane::IsSupportedModifier(uint32_t format,
+                                       uint64_t modifier) const {
+  // Implicit layouts are validated by the kernel when creating the fb.
+  // Same for explicit ones if the plane doesn't advertise IN_FORMATS.
+  if (modifier == DRM_FORMAT_MOD_INVALID || supported_modifiers_.empty())
+    return true;
+
+  for (auto& element : supported_modifiers_) {
+    if (element.first == format && element.second == modifier)
+      return true;
+  }
+
+  return false;
+}
+
 uint32_t DisplayPlane::GetFormatForFrameBuffer(uint32_t format) const {
   // We only support 24 bit colordepth for primary planes on
   // pre SKL Hardware. Ideally, we query format support from
@@ -159,7 +239,12 @@ void DisplayPlane::Dump() const {
   }
 
   for (uint32_t j = 0; j < supported_formats_.size(); j++)
-    DUMPTRACE("Format: %4.4s", (char*)&supported_formats_[j]);
+    DUMPTRACE("Format: " FOURCC_FMT, FOURCC_ARGS(supported_formats_[j]));
+
+  for (uint32_t j = 0; j < supported_modifiers_.size(); j++)
+    DUMPTRACE("Format: " FOURCC_FMT " Modifier: 0x%llx",
+              FOURCC_ARGS(supported_modifiers_[j].first),
+              (unsigned long long)supported_modifiers_[j].second);
 
   DUMPTRACE("Enabled: %d", enabled_);
 
@@ -17,6 +17,7 @@
 #ifndef DISPLAY_PLANE_H_
 #define DISPLAY_PLANE_H_
 
+#include <utility>
 #include <vector>
 
 #include <stdint.h>
@@ -27,6 +28,7 @@
 namespace hwcomposer {
 
 class GpuDevice;
+class OverlayBuffer;
 struct OverlayLayer;
 
 class DisplayPlane {
@@ -41,6 +43,17 @@ class DisplayPlane {
                                 uint32_t crtc_id,
                                 const OverlayLayer* layer) const;
 
+  // Adds only the properties needed to move an already enabled plane to
+  // x, y. If buffer is not NULL, plane is switched to scan it out too.
+  virtual bool UpdateCursorProperties(drmModeAtomicReqPtr property_set,
+                                      int32_t x, int32_t y,
+                                      const OverlayBuffer* buffer) const;
+
+  // Adds only the FB_ID property, switching an already enabled plane to
+  // scan out buffer.
+  virtual bool UpdateFb(drmModeAtomicReqPtr property_set,
+                        const OverlayBuffer* buffer) const;
+
   bool ValidateLayer(const OverlayLayer* layer);
 #ifdef USE_DRM_ATOMIC
   virtual bool Disable(drmModeAtomicReqPtr property_set);
@@ -59,6 +72,8 @@ class DisplayPlane {
 
   bool IsSupportedFormat(uint32_t format);
 
+  bool IsSupportedModifier(uint32_t format, uint64_t modifier) const;
+
   void Dump() const;
 
  protected:
@@ -66,6 +81,7 @@ class DisplayPlane {
   uint32_t GetFormatForFrameBuffer(uint32_t format) const;
   virtual bool InitializeProperties(
       uint32_t gpu_fd, const ScopedDrmObjectPropertyPtr& plane_props);
+  void InitializeModifiers(uint32_t gpu_fd, uint32_t blob_id);
   virtual void DumpAtomic() const;
 
   uint32_t id_;
@@ -79,6 +95,9 @@ class DisplayPlane {
   bool enabled_;
 
   std::vector<uint32_t> supported_formats_;
+
+  // Format and modifier pairs from IN_FORMATS property.
+  std::vector<std::pair<uint32_t, uint64_t>> supported_modifiers_;
 };
 
 }  // namespace hwcomposer
@@ -204,6 +204,45 @@ bool DisplayPlaneAtomic::UpdateProperties(drmModeAtomicReqPtr property_set,
   return true;
 }
 
+bool DisplayPlaneAtomic::UpdateCursorProperties(
+    drmModeAtomicReqPtr property_set, int32_t x, int32_t y,
+    const OverlayBuffer* buffer) const {
+  int success =
+      drmModeAtomicAddProperty(property_set, id_, crtc_x_prop_.id, x) < 0;
+  success |=
+      drmModeAtomicAddProperty(property_set, id_, crtc_y_prop_.id, y) < 0;
+  if (buffer) {
+    success |= drmModeAtomicAddProperty(property_set, id_, fb_prop_.id,
+                                        buffer->GetFb()) < 0;
+    success |= drmModeAtomicAddProperty(property_set, id_, crtc_w_prop_.id,
+                                        buffer->GetWidth()) < 0;
+    success |= drmModeAtomicAddProperty(property_set, id_, crtc_h_prop_.id,
+                                        buffer->GetHeight()) < 0;
+    success |= drmModeAtomicAddProperty(property_set, id_, src_w_prop_.id,
+                                        buffer->GetWidth() << 16) < 0;
+    success |= drmModeAtomicAddProperty(property_set, id_, src_h_prop_.id,
+                                        buffer->GetHeight() << 16) < 0;
+  }
+
+  if (success) {
+    ETRACE("Could not update cursor properties for plane with id: %d", id_);
+    return false;
+  }
+
+  return true;
+}
+
+bool DisplayPlaneAtomic::UpdateFb(drmModeAtomicReqPtr property_set,
+                                  const OverlayBuffer* buffer) const {
+  if (drmModeAtomicAddProperty(property_set, id_, fb_prop_.id,
+                               buffer->GetFb()) < 0) {
+    ETRACE("Could not update fb for plane with id: %d", id_);
+    return false;
+  }
+
+  return true;
+}
+
 bool DisplayPlaneAtomic::Disable(drmModeAtomicReqPtr property_set) {
   enabled_ = false;
   int success =
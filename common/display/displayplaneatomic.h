@@ -32,6 +32,13 @@ class DisplayPlaneAtomic : public DisplayPlane {
   bool UpdateProperties(drmModeAtomicReqPtr property_set, uint32_t crtc_id,
                         const OverlayLayer* layer) const override;
 
+  bool UpdateCursorProperties(drmModeAtomicReqPtr property_set, int32_t x,
+                              int32_t y,
+                              const OverlayBuffer* buffer) const override;
+
+  bool UpdateFb(drmModeAtomicReqPtr property_set,
+                const OverlayBuffer* buffer) const override;
+
   bool Disable(drmModeAtomicReqPtr property_set) override;
 
   bool CanCompositeLayer(const OverlayLayer* layer) override;
@@ -16,6 +16,7 @@
 
 #include "displayplanemanager.h"
 
+#include <algorithm>
 #include <set>
 #include <utility>
 
@@ -27,12 +28,17 @@
 #include "displayplane.h"
 #include "hwctrace.h"
 #include "overlaybuffer.h"
+#include "planeallocator.h"
 
 namespace hwcomposer {
 
 DisplayPlaneManager::DisplayPlaneManager(int gpu_fd, uint32_t pipe_id,
-                                         uint32_t crtc_id)
-    : crtc_id_(crtc_id), pipe_(pipe_id), gpu_fd_(gpu_fd) {
+                                         uint32_t crtc_id,
+                                         PlaneAllocator *allocator)
+    : crtc_id_(crtc_id),
+      pipe_(pipe_id),
+      gpu_fd_(gpu_fd),
+      allocator_(allocator) {
 }
 
 DisplayPlaneManager::~DisplayPlaneManager() {
@@ -78,6 +84,10 @@ bool DisplayPlaneManager::Initialize() {
         plane->SetEnabled(true);
         primary_planes_.emplace_back(std::move(plane));
       } else if (plane->type() == DRM_PLANE_TYPE_OVERLAY) {
+        if (allocator_ && (drm_plane->possible_crtcs & ~pipe_bit))
+          allocator_->AddSharedPlane(drm_plane->plane_id,
+                                     drm_plane->possible_crtcs);
+
         overlay_planes_.emplace_back(std::move(plane));
       }
     }
@@ -120,6 +130,8 @@ bool DisplayPlaneManager::BeginUpdate(std::vector<OverlayLayer> &layers,
     (*i)->SetInUse(false);
   }
 
+  test_commits_ = 0;
+
   size_t size = layers.size();
   for (size_t layer_index = 0; layer_index < size; layer_index++) {
     std::unique_ptr<OverlayBuffer> plane_buffer;
@@ -147,9 +159,28 @@ bool DisplayPlaneManager::BeginUpdate(std::vector<OverlayLayer> &layers,
   return true;
 }
 
+bool DisplayPlaneManager::CanScanOutOnLaterPlane(
+    std::vector<DisplayPlane *>::const_iterator begin,
+    std::vector<DisplayPlane *>::const_iterator end, OverlayLayer *layer,
+    const std::vector<OverlayPlane> &commit_planes) const {
+  std::vector<OverlayPlane> test_planes(commit_planes);
+  test_planes.emplace_back(OverlayPlane(NULL, layer));
+  for (auto i = begin; i != end; ++i) {
+    if (!(*i)->IsSupportedFormat(layer->GetBuffer()->GetFormat()))
+      continue;
+
+    test_planes.back().plane = *i;
+    if (!FallbacktoGPU(*i, layer, test_planes))
+      return true;
+  }
+
+  return false;
+}
+
 std::tuple<bool, DisplayPlaneStateList> DisplayPlaneManager::ValidateLayers(
     std::vector<OverlayLayer> &layers) {
   CTRACE();
+  HWC_TRACE_SLICE("ValidateLayers");
   DisplayPlaneStateList composition;
   std::vector<OverlayPlane> commit_planes;
   OverlayLayer *cursor_layer = NULL;
@@ -157,6 +188,33 @@ std::tuple<bool, DisplayPlaneStateList> DisplayPlaneManager::ValidateLayers(
   auto layer_end = layers.end();
   bool render_layers = false;
   IDISPLAYMANAGERTRACE("ValidateLayers: Total Layers:%d", layers.size());
+  // Let the allocator know how many layers our own overlay planes can't take,
+  // so shared planes move here if we need them more than other displays.
+  std::vector<DisplayPlane *> overlay_planes;
+  if (allocator_) {
+    uint32_t exclusive_planes = 0;
+    for (auto &plane : overlay_planes_) {
+      if (!allocator_->IsShared(plane->id()))
+        exclusive_planes++;
+    }
+
+    // The primary and cursor planes take one layer each.
+    uint32_t overlay_layers = 0;
+    for (size_t i = 1; i < layers.size(); i++) {
+      if (!(layers[i].GetBuffer()->GetUsage() & kLayerCursor))
+        overlay_layers++;
+    }
+
+    allocator_->SetDemand(pipe_, overlay_layers > exclusive_planes
+                                     ? overlay_layers - exclusive_planes
+                                     : 0);
+  }
+
+  for (auto &plane : overlay_planes_) {
+    if (!allocator_ || allocator_->AcquirePlane(plane->id(), pipe_))
+      overlay_planes.emplace_back(plane.get());
+  }
+
   // We start off with Primary plane.
   DisplayPlane *current_plane = primary_planes_.begin()->get();
 
@@ -202,8 +260,20 @@ std::tuple<bool, DisplayPlaneStateList> DisplayPlaneManager::ValidateLayers(
                        cursor_layer ? layers.size() - 2 : layers.size() - 1);
   if (layer_begin != layer_end) {
     // Handle layers for overlay
-    for (auto j = overlay_planes_.begin(); j != overlay_planes_.end(); ++j) {
-      commit_planes.emplace_back(OverlayPlane(j->get(), NULL));
+    for (auto j = overlay_planes.begin(); j != overlay_planes.end(); ++j) {
+      // Leave this plane unused if it can't scan out the video layer but a
+      // later one can, rather than colour convert the video with GPU.
+      if (layer_begin != layer_end &&
+          (layer_begin->GetBuffer()->GetUsage() & kLayerVideo) &&
+          !(*j)->IsSupportedFormat(layer_begin->GetBuffer()->GetFormat()) &&
+          CanScanOutOnLaterPlane(std::next(j), overlay_planes.end(),
+                                 &(*layer_begin), commit_planes)) {
+        IDISPLAYMANAGERTRACE("Skipping plane %d for video layer: %d",
+                             (*j)->id(), layer_begin->GetIndex());
+        continue;
+      }
+
+      commit_planes.emplace_back(OverlayPlane(*j, NULL));
       DisplayPlaneState &last_plane = composition.back();
       // Handle remaining overlay planes.
       for (auto i = layer_begin; i != layer_end; ++i, ++layer_begin) {
@@ -211,10 +281,10 @@ std::tuple<bool, DisplayPlaneStateList> DisplayPlaneManager::ValidateLayers(
         commit_planes.back().layer = layer;
         // If we are able to composite buffer with the given plane, lets use
         // it.
-	if (!FallbacktoGPU(j->get(), layer, commit_planes)) {
+	if (!FallbacktoGPU(*j, layer, commit_planes)) {
           IDISPLAYMANAGERTRACE("Overlay Layer marked for scanout: %d",
                                i->GetIndex());
-          composition.emplace_back(j->get(), layer, i->GetIndex());
+          composition.emplace_back(*j, layer, i->GetIndex());
           ++layer_begin;
           break;
         } else {
@@ -288,6 +358,17 @@ bool DisplayPlaneManager::CommitFrameAtomic(
 
 void DisplayPlaneManager::EndUpdate(drmModeAtomicReqPtr /*pset*/) {
 }
+
+bool DisplayPlaneManager::CommitCursorUpdate(
+    HWCNativeHandle /*handle*/, int32_t /*x*/, int32_t /*y*/,
+    NativeBufferHandler * /*buffer_handler*/, PageFlipState * /*state*/) {
+  return false;
+}
+
+bool DisplayPlaneManager::CommitFrameRepeat(
+    drmModeAtomicReqPtr /*pset*/, PageFlipState * /*state*/) {
+  return false;
+}
 #else
 bool DisplayPlaneManager::CommitFrame(
     std::vector<OverlayLayer> & /*display_comp*/, PageFlipState * /*state*/) {
@@ -319,6 +400,7 @@ bool DisplayPlaneManager::FallbacktoGPU(
   // TODO(kalyank): Take relevant factors into consideration to determine if
   // Plane Composition makes sense. i.e. layer size etc
 
+  test_commits_++;
   if (!TestCommit(commit_planes)) {
     IDISPLAYMANAGERTRACE("TestCommit failed.");
     return true;
@@ -333,6 +415,10 @@ bool DisplayPlaneManager::TestCommit(
   return true;
 }
 
+bool DisplayPlaneManager::OwnsPlane(const DisplayPlane *plane) const {
+  return !allocator_ || allocator_->IsOwner(plane->id(), pipe_);
+}
+
 std::unique_ptr<DisplayPlane> DisplayPlaneManager::CreatePlane(
     uint32_t plane_id, uint32_t possible_crtcs) {
   return std::unique_ptr<DisplayPlane>(
@@ -354,4 +440,14 @@ OverlayBuffer *DisplayPlaneManager::GetOverlayBuffer(const HwcBuffer &bo) {
   return NULL;
 }
 
+OverlayBuffer *DisplayPlaneManager::FindOverlayBuffer(
+    const HwcBuffer &bo) const {
+  for (auto i = overlay_buffers_.begin(); i != overlay_buffers_.end(); ++i) {
+    if ((*i)->IsCompatible(bo))
+      return i->get();
+  }
+
+  return NULL;
+}
+
 }  // namespace hwcomposer
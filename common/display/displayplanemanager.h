@@ -24,6 +24,7 @@
 #include <xf86drmMode.h>
 
 #include <hwcbuffer.h>
+#include <platformdefines.h>
 
 #include "displayplanestate.h"
 
@@ -36,10 +37,14 @@ class NativeBufferHandler;
 class OverlayBuffer;
 struct OverlayLayer;
 class PageFlipState;
+class PlaneAllocator;
 
 class DisplayPlaneManager {
  public:
-  DisplayPlaneManager(int gpu_fd, uint32_t pipe_id, uint32_t crtc_id);
+  // Overlay planes usable by other pipes too are shared through allocator,
+  // which may be NULL to keep all of them to this pipe.
+  DisplayPlaneManager(int gpu_fd, uint32_t pipe_id, uint32_t crtc_id,
+                      PlaneAllocator *allocator);
 
   virtual ~DisplayPlaneManager();
 
@@ -56,6 +61,21 @@ class DisplayPlaneManager {
                                  bool needs_modeset, PageFlipState *state);
 
   virtual void EndUpdate(drmModeAtomicReqPtr pset);
+
+  // Moves the cursor plane used by the last committed frame to x, y without
+  // touching any other plane. If handle differs from the cursor image last
+  // committed, the plane is switched to it as long as it has already been
+  // imported. Returns false if the cursor is not scanned out by a dedicated
+  // plane or the new image is unknown, callers need a full frame then.
+  virtual bool CommitCursorUpdate(HWCNativeHandle handle, int32_t x, int32_t y,
+                                  NativeBufferHandler *buffer_handler,
+                                  PageFlipState *state);
+
+  // Commits pset along with the primary buffer of the last committed frame,
+  // so the CRTC flips to what is on screen already. Returns false if no
+  // frame has been committed yet.
+  virtual bool CommitFrameRepeat(drmModeAtomicReqPtr pset,
+                                 PageFlipState *state);
 #else
   bool CommitFrame(std::vector<OverlayLayer> &comp_layers,
                    PageFlipState *state);
@@ -64,6 +84,11 @@ class DisplayPlaneManager {
 
   void EndFrame();
 
+  // Number of TEST_ONLY commits done by the last ValidateLayers.
+  uint32_t GetTestCommitCount() const {
+    return test_commits_;
+  }
+
  protected:
   struct OverlayPlane {
    public:
@@ -82,15 +107,34 @@ class DisplayPlaneManager {
       DisplayPlane *target_plane, OverlayLayer *layer,
       const std::vector<OverlayPlane> &commit_planes) const;
 
+  // Returns true if one of the planes in [begin, end) can scan out layer
+  // next to commit_planes.
+  bool CanScanOutOnLaterPlane(
+      std::vector<DisplayPlane *>::const_iterator begin,
+      std::vector<DisplayPlane *>::const_iterator end, OverlayLayer *layer,
+      const std::vector<OverlayPlane> &commit_planes) const;
+
   OverlayBuffer *GetOverlayBuffer(const HwcBuffer &bo);
 
+  OverlayBuffer *FindOverlayBuffer(const HwcBuffer &bo) const;
+
+  // Returns true if this pipe has to disable plane when it is unused.
+  bool OwnsPlane(const DisplayPlane *plane) const;
+
   std::vector<std::unique_ptr<DisplayPlane>> primary_planes_;
   std::vector<std::unique_ptr<DisplayPlane>> cursor_planes_;
   std::vector<std::unique_ptr<DisplayPlane>> overlay_planes_;
   std::vector<std::unique_ptr<OverlayBuffer>> overlay_buffers_;
+  DisplayPlane *cursor_plane_ = NULL;
+  OverlayBuffer *cursor_buffer_ = NULL;
+  HWCNativeHandle cursor_handle_ = NULL;
+  DisplayPlane *primary_plane_ = NULL;
+  OverlayBuffer *primary_buffer_ = NULL;
   uint32_t crtc_id_;
   uint32_t pipe_;
   uint32_t gpu_fd_;
+  PlaneAllocator *allocator_;
+  mutable uint32_t test_commits_ = 0;
 };
 
 }  // namespace hwcomposer
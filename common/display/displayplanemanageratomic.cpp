@@ -16,18 +16,22 @@
 
 #include "displayplanemanageratomic.h"
 
+#include <nativebufferhandler.h>
 #include <overlaylayer.h>
 #include <hwctrace.h>
 
+#include "commitcoordinator.h"
 #include "displayplaneatomic.h"
 #include "overlaybuffer.h"
+#include "planeallocator.h"
 
 namespace hwcomposer {
 
-DisplayPlaneManagerAtomic::DisplayPlaneManagerAtomic(uint32_t gpu_fd,
-                                                     uint32_t pipe_id,
-                                                     uint32_t crtc_id)
-    : DisplayPlaneManager(gpu_fd, pipe_id, crtc_id) {
+DisplayPlaneManagerAtomic::DisplayPlaneManagerAtomic(
+    uint32_t gpu_fd, uint32_t pipe_id, uint32_t crtc_id,
+    CommitCoordinator *coordinator, PlaneAllocator *allocator)
+    : DisplayPlaneManager(gpu_fd, pipe_id, crtc_id, allocator),
+      coordinator_(coordinator) {
 }
 
 DisplayPlaneManagerAtomic::~DisplayPlaneManagerAtomic() {
@@ -37,6 +41,7 @@ bool DisplayPlaneManagerAtomic::CommitFrameAtomic(
     DisplayPlaneStateList &comp_planes, drmModeAtomicReqPtr pset,
     bool needs_modeset, PageFlipState *state) {
   CTRACE();
+  HWC_TRACE_SLICE("CommitFrameAtomic");
   if (!pset) {
     ETRACE("Failed to allocate property set %d", -ENOMEM);
     return false;
@@ -53,6 +58,25 @@ bool DisplayPlaneManagerAtomic::CommitFrameAtomic(
 #endif
   }
 
+  // Frames are committed asynchronously to validation, so plane and buffer
+  // usage is derived from this frame alone.
+  for (auto i = cursor_planes_.begin(); i != cursor_planes_.end(); ++i) {
+    (*i)->SetEnabled(false);
+  }
+
+  for (auto i = overlay_planes_.begin(); i != overlay_planes_.end(); ++i) {
+    (*i)->SetEnabled(false);
+  }
+
+  for (auto i = overlay_buffers_.begin(); i != overlay_buffers_.end(); ++i) {
+    (*i)->SetInUse(false);
+  }
+
+  DisplayPlane *primary_plane = NULL;
+  OverlayBuffer *primary_buffer = NULL;
+  DisplayPlane *cursor_plane = NULL;
+  OverlayBuffer *cursor_buffer = NULL;
+  HWCNativeHandle cursor_handle = NULL;
   for (DisplayPlaneState &comp_plane : comp_planes) {
     DisplayPlane *plane = comp_plane.plane();
     OverlayLayer *layer = comp_plane.GetOverlayLayer();
@@ -64,19 +88,115 @@ bool DisplayPlaneManagerAtomic::CommitFrameAtomic(
 
     plane->SetEnabled(true);
     layer->GetBuffer()->SetInUse(true);
+    if (plane->type() == DRM_PLANE_TYPE_PRIMARY) {
+      primary_plane = plane;
+      primary_buffer = layer->GetBuffer();
+    } else if (plane->type() == DRM_PLANE_TYPE_CURSOR) {
+      cursor_plane = plane;
+      cursor_buffer = layer->GetBuffer();
+      cursor_handle = layer->GetNativeHandle();
+    }
   }
 
-  int ret = drmModeAtomicCommit(gpu_fd_, pset, flags, state);
+  DisableUnusedPlanes(pset);
 
+  int ret = coordinator_->Commit(crtc_id_, pset, flags, state);
   if (ret) {
     ETRACE("Failed to commit pset ret=%s\n", PRINTERROR());
     return false;
   }
 
+  if (allocator_) {
+    std::vector<uint32_t> enabled_planes;
+    for (auto i = overlay_planes_.begin(); i != overlay_planes_.end(); ++i) {
+      if ((*i)->IsEnabled())
+        enabled_planes.emplace_back((*i)->id());
+    }
+
+    allocator_->FrameCommitted(pipe_, enabled_planes);
+  }
+
+  primary_plane_ = primary_plane;
+  primary_buffer_ = primary_buffer;
+  cursor_plane_ = cursor_plane;
+  cursor_buffer_ = cursor_buffer;
+  cursor_handle_ = cursor_handle;
+
+  return true;
+}
+
+bool DisplayPlaneManagerAtomic::CommitFrameRepeat(drmModeAtomicReqPtr pset,
+                                                  PageFlipState *state) {
+  CTRACE();
+  if (!primary_plane_ || !primary_buffer_)
+    return false;
+
+  // The buffer stays in use till the next frame is committed.
+  if (!primary_plane_->UpdateFb(pset, primary_buffer_))
+    return false;
+
+  int ret = coordinator_->Commit(
+      crtc_id_, pset, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK,
+      state);
+  if (ret) {
+    IDISPLAYMANAGERTRACE("Failed to commit frame repeat ret=%s", PRINTERROR());
+    return false;
+  }
+
   return true;
 }
 
-void DisplayPlaneManagerAtomic::EndUpdate(drmModeAtomicReqPtr pset) {
+bool DisplayPlaneManagerAtomic::CommitCursorUpdate(
+    HWCNativeHandle handle, int32_t x, int32_t y,
+    NativeBufferHandler *buffer_handler, PageFlipState *state) {
+  CTRACE();
+  if (!cursor_plane_ || !cursor_buffer_)
+    return false;
+
+  OverlayBuffer *buffer = NULL;
+  if (handle != cursor_handle_) {
+    HwcBuffer bo;
+    if (!buffer_handler->ImportBuffer(handle, &bo)) {
+      ETRACE("Failed to Import cursor buffer.");
+      return false;
+    }
+
+    buffer = FindOverlayBuffer(bo);
+    if (!buffer || buffer->GetFb() == 0) {
+      IDISPLAYMANAGERTRACE("Cursor image not imported yet, needs full frame.");
+      return false;
+    }
+  }
+
+  ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
+  if (!pset) {
+    ETRACE("Failed to allocate property set %d", -ENOMEM);
+    return false;
+  }
+
+  if (!cursor_plane_->UpdateCursorProperties(pset.get(), x, y, buffer))
+    return false;
+
+  // Tiles of a panel move their cursors in the same commit too.
+  int ret = coordinator_->Commit(
+      crtc_id_, pset.get(),
+      DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK, state);
+  if (ret) {
+    IDISPLAYMANAGERTRACE("Failed to commit cursor update ret=%s",
+                         PRINTERROR());
+    return false;
+  }
+
+  if (buffer) {
+    buffer->SetInUse(true);
+    cursor_buffer_ = buffer;
+    cursor_handle_ = handle;
+  }
+
+  return true;
+}
+
+void DisplayPlaneManagerAtomic::DisableUnusedPlanes(drmModeAtomicReqPtr pset) {
   for (auto i = cursor_planes_.begin(); i != cursor_planes_.end(); ++i) {
     if ((*i)->IsEnabled())
       continue;
@@ -85,12 +205,15 @@ void DisplayPlaneManagerAtomic::EndUpdate(drmModeAtomicReqPtr pset) {
   }
 
   for (auto i = overlay_planes_.begin(); i != overlay_planes_.end(); ++i) {
-    if ((*i)->IsEnabled())
+    // Shared planes scanned out by another pipe are left to it.
+    if ((*i)->IsEnabled() || !OwnsPlane(i->get()))
       continue;
 
     (*i)->Disable(pset);
   }
+}
 
+void DisplayPlaneManagerAtomic::EndUpdate(drmModeAtomicReqPtr /*pset*/) {
   for (auto i = overlay_buffers_.begin(); i != overlay_buffers_.end();) {
     OverlayBuffer *buffer = i->get();
     if (buffer->InUse()) {
@@ -113,6 +236,7 @@ void DisplayPlaneManagerAtomic::EndUpdate(drmModeAtomicReqPtr pset) {
 
 bool DisplayPlaneManagerAtomic::TestCommit(
     const std::vector<OverlayPlane> &commit_planes) const {
+  HWC_TRACE_SLICE("TestCommit");
   ScopedDrmAtomicReqPtr pset(drmModeAtomicAlloc());
   IDISPLAYMANAGERTRACE("Total planes for Test Commit. %d ",
                        commit_planes.size());
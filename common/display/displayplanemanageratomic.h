@@ -21,13 +21,17 @@
 
 namespace hwcomposer {
 
+class CommitCoordinator;
 class DisplayPlane;
 class GpuDevice;
 
 class DisplayPlaneManagerAtomic : public DisplayPlaneManager {
  public:
+  // Frames are committed through coordinator, which merges them with the
+  // commits of CRTCs in the same sync group.
   DisplayPlaneManagerAtomic(uint32_t gpu_fd, uint32_t pipe_id,
-                            uint32_t crtc_id);
+                            uint32_t crtc_id, CommitCoordinator *coordinator,
+                            PlaneAllocator *allocator);
 
   virtual ~DisplayPlaneManagerAtomic();
 
@@ -37,11 +41,23 @@ class DisplayPlaneManagerAtomic : public DisplayPlaneManager {
 
   void EndUpdate(drmModeAtomicReqPtr pset) override;
 
+  bool CommitCursorUpdate(HWCNativeHandle handle, int32_t x, int32_t y,
+                          NativeBufferHandler *buffer_handler,
+                          PageFlipState *state) override;
+
+  bool CommitFrameRepeat(drmModeAtomicReqPtr pset,
+                         PageFlipState *state) override;
+
  protected:
   std::unique_ptr<DisplayPlane> CreatePlane(uint32_t plane_id,
                                             uint32_t possible_crtcs) override;
   bool TestCommit(
       const std::vector<OverlayPlane> &commit_planes) const override;
+
+ private:
+  void DisableUnusedPlanes(drmModeAtomicReqPtr pset);
+
+  CommitCoordinator *coordinator_;
 };
 
 }  // namespace hwcomposer
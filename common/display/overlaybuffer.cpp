@@ -21,10 +21,13 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <vector>
+
 #include <hwcdefs.h>
 #include <nativebufferhandler.h>
 
 #include "hwctrace.h"
+#include "hwcutils.h"
 
 namespace hwcomposer {
 
@@ -41,6 +44,7 @@ void OverlayBuffer::Initialize(const HwcBuffer& bo) {
     pitches_[i] = bo.pitches[i];
     offsets_[i] = bo.offsets[i];
     gem_handles_[i] = bo.gem_handles[i];
+    modifiers_[i] = bo.modifiers[i];
   }
 
   reset_framebuffer_ = ((prime_fd_ != bo.prime_fd) || fb_id_ == 0);
@@ -84,6 +88,9 @@ bool OverlayBuffer::IsCompatible(const HwcBuffer& bo) const {
 
     if (gem_handles_[i] != bo.gem_handles[i])
       return false;
+
+    if (modifiers_[i] != bo.modifiers[i])
+      return false;
   }
 
   return true;
@@ -91,40 +98,65 @@ bool OverlayBuffer::IsCompatible(const HwcBuffer& bo) const {
 
 GpuImage OverlayBuffer::ImportImage(GpuDisplay egl_display) {
 #ifdef USE_GL
-  EGLImageKHR image = EGL_NO_IMAGE_KHR;
-  // Note: If eglCreateImageKHR is successful for a EGL_LINUX_DMA_BUF_EXT
-  // target, the EGL will take a reference to the dma_buf.
-  if (format_ == DRM_FORMAT_YUV420) {
-    const EGLint attr_list_yv12[] = {
-        EGL_WIDTH,                     static_cast<EGLint>(width_),
-        EGL_HEIGHT,                    static_cast<EGLint>(height_),
-        EGL_LINUX_DRM_FOURCC_EXT,      DRM_FORMAT_YUV420,
-        EGL_DMA_BUF_PLANE0_FD_EXT,     static_cast<EGLint>(prime_fd_),
-        EGL_DMA_BUF_PLANE0_PITCH_EXT,  static_cast<EGLint>(pitches_[0]),
-        EGL_DMA_BUF_PLANE0_OFFSET_EXT, static_cast<EGLint>(offsets_[0]),
-        EGL_DMA_BUF_PLANE1_FD_EXT,     static_cast<EGLint>(prime_fd_),
-        EGL_DMA_BUF_PLANE1_PITCH_EXT,  static_cast<EGLint>(pitches_[1]),
-        EGL_DMA_BUF_PLANE1_OFFSET_EXT, static_cast<EGLint>(offsets_[1]),
-        EGL_DMA_BUF_PLANE2_FD_EXT,     static_cast<EGLint>(prime_fd_),
-        EGL_DMA_BUF_PLANE2_PITCH_EXT,  static_cast<EGLint>(pitches_[2]),
-        EGL_DMA_BUF_PLANE2_OFFSET_EXT, static_cast<EGLint>(offsets_[2]),
-        EGL_NONE,                      0};
-    image = eglCreateImageKHR(
-        egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
-        static_cast<EGLClientBuffer>(nullptr), attr_list_yv12);
-  } else {
-    const EGLint attr_list[] = {
-        EGL_WIDTH,                     static_cast<EGLint>(width_),
-        EGL_HEIGHT,                    static_cast<EGLint>(height_),
-        EGL_LINUX_DRM_FOURCC_EXT,      static_cast<EGLint>(format_),
-        EGL_DMA_BUF_PLANE0_FD_EXT,     static_cast<EGLint>(prime_fd_),
-        EGL_DMA_BUF_PLANE0_PITCH_EXT,  static_cast<EGLint>(pitches_[0]),
-        EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-        EGL_NONE,                      0};
-    image =
-        eglCreateImageKHR(egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
-                          static_cast<EGLClientBuffer>(nullptr), attr_list);
-  }
+  // clang-format off
+  static const EGLint kPlaneAttributes[][5] = {
+      {EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_PITCH_EXT,
+       EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+       EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT},
+      {EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT,
+       EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+       EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT},
+      {EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT,
+       EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+       EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT}};
+  // clang-format on
+
+  auto create_image = [&](bool with_modifier) {
+    std::vector<EGLint> attr_list = {
+        EGL_WIDTH,  static_cast<EGLint>(width_),
+        EGL_HEIGHT, static_cast<EGLint>(height_),
+        EGL_LINUX_DRM_FOURCC_EXT, static_cast<EGLint>(format_)};
+    // All planes live in the same dma_buf, only pitch and offset differ.
+    // The compression data of a compressed buffer is only understood along
+    // with its modifier.
+    uint32_t total_planes =
+        with_modifier ? GetTotalPlanes(format_, modifiers_[0])
+                      : GetTotalPlanesForFormat(format_);
+    for (uint32_t i = 0; i < total_planes; i++) {
+      const EGLint* plane = kPlaneAttributes[i];
+      attr_list.insert(attr_list.end(),
+                       {plane[0], static_cast<EGLint>(prime_fd_), plane[1],
+                        static_cast<EGLint>(pitches_[i]), plane[2],
+                        static_cast<EGLint>(offsets_[i])});
+      if (with_modifier) {
+        attr_list.insert(
+            attr_list.end(),
+            {plane[3], static_cast<EGLint>(modifiers_[i] & 0xffffffff),
+             plane[4], static_cast<EGLint>(modifiers_[i] >> 32)});
+      }
+    }
+    attr_list.push_back(EGL_NONE);
+
+    // Note: If eglCreateImageKHR is successful for a EGL_LINUX_DMA_BUF_EXT
+    // target, the EGL will take a reference to the dma_buf.
+    return eglCreateImageKHR(egl_display, EGL_NO_CONTEXT,
+                             EGL_LINUX_DMA_BUF_EXT,
+                             static_cast<EGLClientBuffer>(nullptr),
+                             attr_list.data());
+  };
+
+  // Drivers without EGL_EXT_image_dma_buf_import_modifiers reject the
+  // modifier attributes, the implicit tiling of the gem object applies
+  // without them.
+  // Compressed buffers can't be read without the modifier.
+  bool with_modifier = modifiers_[0] != DRM_FORMAT_MOD_INVALID;
+  EGLImageKHR image = create_image(with_modifier);
+  if (image == EGL_NO_IMAGE_KHR && with_modifier &&
+      !IsCompressedModifier(modifiers_[0]))
+    image = create_image(false);
+
+  if (image == EGL_NO_IMAGE_KHR)
+    ETRACE("Failed to import buffer with format %4.4s.", (char*)&format_);
 
   return image;
 #else
@@ -143,13 +175,34 @@ bool OverlayBuffer::CreateFrameBuffer(uint32_t gpu_fd) {
   if (fb_id_ && gpu_fd_ && drmModeRmFB(gpu_fd_, fb_id_))
     ETRACE("Failed to remove fb");
 
-  int ret = drmModeAddFB2(gpu_fd, width_, height_, format_, gem_handles_,
-                          pitches_, offsets_, &fb_id_, 0);
+  // Multi planar buffers share one gem object unless gralloc says otherwise.
+  // Kernel expects handle and modifier to be set for each plane, and unused
+  // planes to be 0.
+  uint32_t gem_handles[4] = {0, 0, 0, 0};
+  uint64_t modifiers[4] = {0, 0, 0, 0};
+  uint32_t total_planes = GetTotalPlanes(format_, modifiers_[0]);
+  for (uint32_t i = 0; i < total_planes; i++) {
+    gem_handles[i] = gem_handles_[i] ? gem_handles_[i] : gem_handles_[0];
+    modifiers[i] = modifiers_[i];
+  }
+
+  int ret;
+  if (modifiers_[0] != DRM_FORMAT_MOD_INVALID) {
+    ret = drmModeAddFB2WithModifiers(
+        gpu_fd, width_, height_, format_, gem_handles, pitches_, offsets_,
+        modifiers, &fb_id_, DRM_MODE_FB_MODIFIERS);
+  } else {
+    ret = drmModeAddFB2(gpu_fd, width_, height_, format_, gem_handles,
+                        pitches_, offsets_, &fb_id_, 0);
+  }
 
   if (ret) {
-    ETRACE("drmModeAddFB2 error (%dx%d, %c%c%c%c, handle %d pitch %d) (%s)",
-           width_, height_, format_, format_ >> 8, format_ >> 16, format_ >> 24,
-           gem_handles_[0], pitches_[0], strerror(-ret));
+    ETRACE(
+        "drmModeAddFB2 error (%dx%d, %c%c%c%c, handle %d pitch %d modifier "
+        "0x%llx) (%s)",
+        width_, height_, format_, format_ >> 8, format_ >> 16, format_ >> 24,
+        gem_handles_[0], pitches_[0], (unsigned long long)modifiers_[0],
+        strerror(-ret));
 
     fb_id_ = 0;
     return false;
@@ -174,11 +227,13 @@ void OverlayBuffer::Dump() {
   DUMPTRACE("Height: %d", height_);
   DUMPTRACE("Fb: %d", fb_id_);
   DUMPTRACE("Prime Handle: %d", prime_fd_);
-  DUMPTRACE("Format: %4.4s", (char*)&format_);
+  DUMPTRACE("Format: " FOURCC_FMT, FOURCC_ARGS(format_));
   for (uint32_t i = 0; i < 4; i++) {
     DUMPTRACE("Pitch:%d value:%d", i, pitches_[i]);
     DUMPTRACE("Offset:%d value:%d", i, offsets_[i]);
     DUMPTRACE("Gem Handles:%d value:%d", i, gem_handles_[i]);
+    DUMPTRACE("Modifier:%d value:0x%llx", i,
+              (unsigned long long)modifiers_[i]);
   }
   DUMPTRACE("OverlayBuffer Information Ends. -------------");
 }
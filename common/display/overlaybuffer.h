@@ -55,6 +55,10 @@ class OverlayBuffer {
     return pitches_[0];
   }
 
+  uint64_t GetModifier() const {
+    return modifiers_[0];
+  }
+
   uint32_t GetUsage() const {
     return usage_;
   }
@@ -101,6 +105,7 @@ class OverlayBuffer {
   uint32_t pitches_[4];
   uint32_t offsets_[4];
   uint32_t gem_handles_[4];
+  uint64_t modifiers_[4];
   uint32_t fb_id_ = 0;
   uint32_t prime_fd_ = 0;
   uint32_t usage_ = 0;
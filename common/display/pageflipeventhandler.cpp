@@ -17,10 +17,16 @@
 #include "pageflipeventhandler.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
 #include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
 
 #include <hwctrace.h>
 
+#include "internaldisplay.h"
+
 namespace hwcomposer {
 
 static const int64_t kOneSecondNs = 1 * 1000 * 1000 * 1000;
@@ -31,12 +37,31 @@ PageFlipEventHandler::PageFlipEventHandler() {
 PageFlipEventHandler::~PageFlipEventHandler() {
 }
 
-void PageFlipEventHandler::Init(float refresh) {
+void PageFlipEventHandler::Init(float refresh, InternalDisplay *display) {
   refresh_ = refresh;
+  internal_display_ = display;
+  std::lock_guard<std::mutex> lock(vblank_lock_);
+  last_vblank_ns_ = 0;
+  frame_period_ns_ = refresh > 0 ? static_cast<int64_t>(kOneSecondNs / refresh)
+                                 : kOneSecondNs / 60;
+}
+
+bool PageFlipEventHandler::InitVSync(uint32_t gpu_fd, uint32_t pipe) {
+  gpu_fd_ = gpu_fd;
+  pipe_ = pipe;
+  vsync_timer_fd_.Reset(
+      timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK));
+  if (vsync_timer_fd_.get() < 0) {
+    ETRACE("Failed to create vsync timer. %s", PRINTERROR());
+    return false;
+  }
+
+  return true;
 }
 
 int PageFlipEventHandler::RegisterCallback(
     std::shared_ptr<VsyncCallback> callback, uint32_t display) {
+  std::lock_guard<std::mutex> lock(vsync_lock_);
   callback_ = callback;
   display_ = display;
   last_timestamp_ = -1;
@@ -46,29 +71,164 @@ int PageFlipEventHandler::RegisterCallback(
 
 int PageFlipEventHandler::VSyncControl(bool enabled) {
   IPAGEFLIPEVENTTRACE("PageFlipEventHandler VSyncControl enabled %d", enabled);
+  std::lock_guard<std::mutex> lock(vsync_lock_);
   if (enabled_ == enabled)
     return 0;
 
   enabled_ = enabled;
   last_timestamp_ = -1;
+  if (!enabled_) {
+    // A vblank event already requested gets dropped once it arrives.
+    ArmVSyncTimer(false);
+  } else if (!vblank_pending_) {
+    RequestVBlank();
+  }
 
   return 0;
 }
 
-void PageFlipEventHandler::HandlePageFlipEvent(unsigned int sec,
-                                               unsigned int usec) {
+void PageFlipEventHandler::RequestVBlank() {
+  uint32_t type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+  if (pipe_ == 1)
+    type |= DRM_VBLANK_SECONDARY;
+  else if (pipe_ > 1)
+    type |= (pipe_ << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+
+  drmVBlank vblank;
+  memset(&vblank, 0, sizeof(vblank));
+  vblank.request.type = (drmVBlankSeqType)type;
+  vblank.request.sequence = 1;
+  vblank.request.signal = (unsigned long)this;
+  if (!drmWaitVBlank(gpu_fd_, &vblank)) {
+    vblank_pending_ = true;
+    return;
+  }
+
+  // There are no vblank interrupts while the CRTC is off, so keep vsync
+  // going in software till it's back.
+  IPAGEFLIPEVENTTRACE("drmWaitVBlank failed for pipe %d, using timer. %s",
+                      pipe_, PRINTERROR());
+  ArmVSyncTimer(true);
+}
+
+void PageFlipEventHandler::ArmVSyncTimer(bool arm) {
+  struct itimerspec timeout;
+  memset(&timeout, 0, sizeof(timeout));
+  if (arm) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now = (int64_t)ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+    int64_t next = GetNextVBlankTime(now);
+    if (!next) {
+      std::lock_guard<std::mutex> lock(vblank_lock_);
+      next = now + (frame_period_ns_ ? frame_period_ns_ : kOneSecondNs / 60);
+    }
+
+    timeout.it_value.tv_sec = next / kOneSecondNs;
+    timeout.it_value.tv_nsec = next % kOneSecondNs;
+  }
+
+  if (timerfd_settime(vsync_timer_fd_.get(), TFD_TIMER_ABSTIME, &timeout,
+                      NULL)) {
+    ETRACE("Failed to set vsync timer. %s", PRINTERROR());
+  }
+}
+
+void PageFlipEventHandler::HandleVSyncTimer() {
   // This is called from DisplayManager thread.
-  std::shared_ptr<VsyncCallback> callback(callback_);
-  if (!enabled_ || !callback)
+  uint64_t expirations;
+  if (read(vsync_timer_fd_.get(), &expirations, sizeof(expirations)) < 0)
     return;
 
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int64_t timestamp = (int64_t)ts.tv_sec * kOneSecondNs + ts.tv_nsec;
+  std::shared_ptr<VsyncCallback> callback;
+  {
+    std::lock_guard<std::mutex> lock(vsync_lock_);
+    if (!enabled_ || vblank_pending_)
+      return;
+
+    callback = callback_;
+    // Switches back to vblank events if the CRTC is on again.
+    RequestVBlank();
+  }
+
+  NotifyVSync(callback, timestamp);
+}
+
+void PageFlipEventHandler::HandleVBlankEvent(unsigned int sec,
+                                             unsigned int usec) {
+  // This is called from DisplayManager thread.
+  HWC_TRACE_SLICE("VBlankEvent");
   int64_t timestamp = (int64_t)sec * kOneSecondNs + (int64_t)usec * 1000;
+  UpdateVBlankModel(timestamp);
+
+  std::shared_ptr<VsyncCallback> callback;
+  {
+    std::lock_guard<std::mutex> lock(vsync_lock_);
+    vblank_pending_ = false;
+    if (!enabled_)
+      return;
+
+    callback = callback_;
+    RequestVBlank();
+  }
+
+  NotifyVSync(callback, timestamp);
+}
+
+void PageFlipEventHandler::NotifyVSync(std::shared_ptr<VsyncCallback> callback,
+                                       int64_t timestamp) {
+  if (!callback)
+    return;
+
   IPAGEFLIPEVENTTRACE("HandleVblankCallBack Frame Time %f",
                       float(timestamp - last_timestamp_) / (1000));
   last_timestamp_ = timestamp;
-
-  IPAGEFLIPEVENTTRACE("Callback called from HandlePageFlipEvent. %lu",
-                      timestamp);
   callback->Callback(display_, timestamp);
 }
+
+int64_t PageFlipEventHandler::GetNextVBlankTime(int64_t now) {
+  std::lock_guard<std::mutex> lock(vblank_lock_);
+  if (!last_vblank_ns_ || !frame_period_ns_)
+    return 0;
+
+  if (now < last_vblank_ns_)
+    return last_vblank_ns_;
+
+  int64_t frames = (now - last_vblank_ns_) / frame_period_ns_ + 1;
+  return last_vblank_ns_ + frames * frame_period_ns_;
+}
+
+void PageFlipEventHandler::UpdateVBlankModel(int64_t timestamp) {
+  std::lock_guard<std::mutex> lock(vblank_lock_);
+  if (last_vblank_ns_ && frame_period_ns_ && timestamp > last_vblank_ns_) {
+    // Flips don't happen every vblank, so divide the interval by the number
+    // of vblanks it spans before folding it into the period estimate.
+    int64_t delta = timestamp - last_vblank_ns_;
+    int64_t frames = (delta + frame_period_ns_ / 2) / frame_period_ns_;
+    if (frames > 0 && frames <= 8) {
+      int64_t period = delta / frames;
+      // Ignore outliers, i.e. anything off by more than 1/8th of a frame.
+      if (std::abs(period - frame_period_ns_) < frame_period_ns_ / 8)
+        frame_period_ns_ += (period - frame_period_ns_) / 8;
+    }
+  }
+
+  last_vblank_ns_ = timestamp;
+}
+
+void PageFlipEventHandler::HandlePageFlipEvent(unsigned int sec,
+                                               unsigned int usec) {
+  // This is called from DisplayManager thread.
+  HWC_TRACE_SLICE("PageFlipEvent");
+  int64_t timestamp = (int64_t)sec * kOneSecondNs + (int64_t)usec * 1000;
+  UpdateVBlankModel(timestamp);
+
+  // Vsync is driven by vblank events, not by our own flips, so it keeps
+  // going while nothing gets presented.
+  if (internal_display_)
+    internal_display_->PageFlipCompleted(timestamp);
+}
 }
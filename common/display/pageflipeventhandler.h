@@ -19,35 +19,81 @@
 
 #include <stdint.h>
 
+#include <mutex>
+
 #include <nativedisplay.h>
+#include <scopedfd.h>
 
 namespace hwcomposer {
 
+class InternalDisplay;
+
 class PageFlipEventHandler {
  public:
   PageFlipEventHandler();
   ~PageFlipEventHandler();
 
-  void Init(float refresh);
+  void Init(float refresh, InternalDisplay *display);
+
+  // Sets up vsync for the CRTC at pipe.
+  bool InitVSync(uint32_t gpu_fd, uint32_t pipe);
 
   void HandlePageFlipEvent(unsigned int sec, unsigned int usec);
 
+  // Vblank events requested while vsync is enabled. Called from
+  // DisplayManager thread.
+  void HandleVBlankEvent(unsigned int sec, unsigned int usec);
+
+  // Software vsync, used while the CRTC can't deliver vblank events. The
+  // fd is polled by DisplayManager, which calls HandleVSyncTimer().
+  int GetVSyncTimerFd() const {
+    return vsync_timer_fd_.get();
+  }
+
+  void HandleVSyncTimer();
+
   int RegisterCallback(std::shared_ptr<VsyncCallback> callback,
                        uint32_t display_id);
 
   int VSyncControl(bool enabled);
 
+  // Returns the predicted time (CLOCK_MONOTONIC, in ns) of the first vblank
+  // after now, based on the timestamps of previous page flips. Returns 0 if
+  // no page flip has completed yet.
+  int64_t GetNextVBlankTime(int64_t now);
+
  private:
+  void UpdateVBlankModel(int64_t timestamp);
+
+  // Called with vsync_lock_ held.
+  void RequestVBlank();
+  void ArmVSyncTimer(bool arm);
+
+  void NotifyVSync(std::shared_ptr<VsyncCallback> callback, int64_t timestamp);
+
   // shared_ptr since we need to use this outside of the thread lock (to
   // actually call the hook) and we don't want the memory freed until we're
   // done
   std::shared_ptr<VsyncCallback> callback_ = NULL;
 
+  InternalDisplay *internal_display_ = NULL;
   uint32_t display_;
-  bool enabled_;
+  uint32_t gpu_fd_ = 0;
+  uint32_t pipe_ = 0;
+  ScopedFd vsync_timer_fd_;
+  // Protects callback_, enabled_ and vblank_pending_.
+  std::mutex vsync_lock_;
+  bool enabled_ = false;
+  bool vblank_pending_ = false;
 
   float refresh_;
   int64_t last_timestamp_;
+
+  // Vblank phase and period as observed from page flip events. Updated from
+  // DisplayManager thread and read from CommitThread.
+  std::mutex vblank_lock_;
+  int64_t last_vblank_ns_ = 0;
+  int64_t frame_period_ns_ = 0;
 };
 
 }  // namespace
@@ -21,24 +21,49 @@
 
 namespace hwcomposer {
 
-PageFlipState::PageFlipState(NativeSync* sync_object,
+PageFlipState::PageFlipState(NativeSync* timeline, int sync_point,
                              PageFlipEventHandler* flip_handler, uint32_t pipe)
-    : sync_object_(sync_object), flip_handler_(flip_handler), pipe_(pipe) {
-  time_line_fd_ = sync_object_->CreateNextTimelineFence();
-  DUMPTRACE("PageFlipState Created with timeline fd: %d sync fd: %d",
-            time_line_fd_, sync_object_->GetFd());
+    : timeline_(timeline),
+      flip_handler_(flip_handler),
+      sync_point_(sync_point),
+      pipe_(pipe) {
+  // Cursor only updates don't signal any fences.
+  if (!timeline_)
+    return;
+
+  DUMPTRACE("PageFlipState Created for sync point: %d sync fd: %d",
+            sync_point_, timeline_->GetFd());
 }
 
 PageFlipState::~PageFlipState() {
-  DUMPTRACE("PageFlipState being destroyed.");
-  DUMPTRACE("PageFlipState closing timeline fd: %d", time_line_fd_);
+  // Events of merged CRTCs which never arrived.
+  for (auto& merged : merged_states_)
+    delete merged.second;
+
+  if (!timeline_)
+    return;
+
+  DUMPTRACE("PageFlipState signalling sync point: %d", sync_point_);
+  timeline_->SignalPoint(sync_point_);
+}
 
-  close(time_line_fd_);
+void PageFlipState::AddMergedState(uint32_t crtc_id, PageFlipState* state) {
+  merged_states_[crtc_id] = state;
+  pending_events_++;
+}
 
-  DUMPTRACE("PageFlipState releasing sync fd: %d", sync_object_->GetFd());
+void PageFlipState::ClearMergedStates() {
+  merged_states_.clear();
+  pending_events_ = 1;
+}
 
-  delete sync_object_;
+PageFlipState* PageFlipState::TakeMergedState(uint32_t crtc_id) {
+  auto merged = merged_states_.find(crtc_id);
+  if (merged == merged_states_.end())
+    return NULL;
 
-  DUMPTRACE("PageFlipState destroyed.");
+  PageFlipState* state = merged->second;
+  merged_states_.erase(merged);
+  return state;
 }
 }
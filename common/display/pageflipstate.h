@@ -19,6 +19,8 @@
 
 #include <stdint.h>
 
+#include <map>
+
 namespace hwcomposer {
 
 class NativeSync;
@@ -26,19 +28,46 @@ class PageFlipEventHandler;
 
 class PageFlipState {
  public:
-  PageFlipState(NativeSync* sync_object, PageFlipEventHandler* flip_handler,
-                uint32_t pipe);
+  // sync_point of timeline is signalled once the flip completes, when the
+  // state gets deleted. timeline can be NULL for updates without fences.
+  PageFlipState(NativeSync* timeline, int sync_point,
+                PageFlipEventHandler* flip_handler, uint32_t pipe);
   ~PageFlipState();
 
   PageFlipEventHandler* GetFlipHandler() const {
     return flip_handler_;
   }
 
+  // Called if the commit failed. The frame on screen stays there, so its
+  // buffers must not be released; the next flip signals past sync_point.
+  void Discard() {
+    timeline_ = NULL;
+  }
+
+  // Takes ownership of state, the state of crtc_id which got committed along
+  // with this one. A merged commit sends the flip event of each CRTC with
+  // this state as user data, so it stays around till all of them arrived.
+  void AddMergedState(uint32_t crtc_id, PageFlipState* state);
+
+  // Hands the merged states back to their owners if the commit failed.
+  void ClearMergedStates();
+
+  // Returns the merged state of crtc_id, which the caller now owns, or NULL
+  // if the event is for the CRTC of this state.
+  PageFlipState* TakeMergedState(uint32_t crtc_id);
+
+  // Returns true once the flip events of all CRTCs have been received.
+  bool FlipEventReceived() {
+    return --pending_events_ == 0;
+  }
+
  private:
-  NativeSync* sync_object_;
+  NativeSync* timeline_;
   PageFlipEventHandler* flip_handler_;
-  int time_line_fd_;
+  int sync_point_;
   uint32_t pipe_;
+  uint32_t pending_events_ = 1;
+  std::map<uint32_t, PageFlipState*> merged_states_;
 };
 
 }  // namespace
@@ -0,0 +1,204 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "planeallocator.h"
+
+#include <algorithm>
+
+#include <hwctrace.h>
+
+namespace hwcomposer {
+
+PlaneAllocator::PlaneAllocator() {
+}
+
+PlaneAllocator::~PlaneAllocator() {
+}
+
+void PlaneAllocator::AddSharedPlane(uint32_t plane_id,
+                                    uint32_t possible_crtcs) {
+  std::lock_guard<std::mutex> lock(lock_);
+  planes_[plane_id].possible_crtcs = possible_crtcs;
+}
+
+bool PlaneAllocator::IsShared(uint32_t plane_id) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return planes_.find(plane_id) != planes_.end();
+}
+
+void PlaneAllocator::SetDemand(uint32_t pipe, uint32_t demand) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (idle_.count(pipe))
+    demand = 0;
+
+  uint32_t &current = demand_[pipe];
+  if (current != demand) {
+    current = demand;
+    Rebalance();
+  }
+
+  // This frame is validated without the planes moving away from pipe.
+  for (auto &entry : planes_) {
+    SharedPlane &plane = entry.second;
+    if (plane.owner == pipe && plane.target != pipe)
+      plane.released = true;
+  }
+}
+
+bool PlaneAllocator::AcquirePlane(uint32_t plane_id, uint32_t pipe) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto entry = planes_.find(plane_id);
+  if (entry == planes_.end())
+    return true;
+
+  SharedPlane &plane = entry->second;
+  if (plane.target != pipe)
+    return false;
+
+  if (plane.owner == kNoPipe)
+    plane.owner = pipe;
+
+  return plane.owner == pipe;
+}
+
+bool PlaneAllocator::IsOwner(uint32_t plane_id, uint32_t pipe) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto entry = planes_.find(plane_id);
+  return entry == planes_.end() || entry->second.owner == pipe;
+}
+
+void PlaneAllocator::FrameCommitted(uint32_t pipe,
+                                    const std::vector<uint32_t> &enabled) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto &entry : planes_) {
+    SharedPlane &plane = entry.second;
+    if (plane.owner != pipe || plane.target == pipe || !plane.released)
+      continue;
+
+    plane.release_pending =
+        std::find(enabled.begin(), enabled.end(), entry.first) ==
+        enabled.end();
+  }
+}
+
+void PlaneAllocator::FrameFlipped(uint32_t pipe) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto &entry : planes_) {
+    SharedPlane &plane = entry.second;
+    if (plane.owner != pipe || !plane.release_pending)
+      continue;
+
+    plane.release_pending = false;
+    if (plane.target == pipe)
+      continue;
+
+    IDISPLAYMANAGERTRACE("Shared plane %d moves from pipe %d to pipe %d",
+                         entry.first, pipe, plane.target);
+    plane.owner = plane.target;
+    plane.released = false;
+  }
+}
+
+void PlaneAllocator::SetIdle(uint32_t pipe, bool idle) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!idle) {
+    // The next SetDemand brings the demand of pipe back.
+    idle_.erase(pipe);
+    return;
+  }
+
+  idle_.insert(pipe);
+  uint32_t &current = demand_[pipe];
+  if (current) {
+    current = 0;
+    Rebalance();
+  }
+}
+
+bool PlaneAllocator::HasPlanesToRelease(uint32_t pipe) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (auto &entry : planes_) {
+    const SharedPlane &plane = entry.second;
+    if (plane.owner == pipe && plane.target != pipe && !plane.release_pending)
+      return true;
+  }
+
+  return false;
+}
+
+void PlaneAllocator::ReleasePipe(uint32_t pipe) {
+  std::lock_guard<std::mutex> lock(lock_);
+  demand_.erase(pipe);
+  idle_.erase(pipe);
+  for (auto &entry : planes_) {
+    SharedPlane &plane = entry.second;
+    if (plane.owner != pipe)
+      continue;
+
+    plane.owner = kNoPipe;
+    plane.released = false;
+    plane.release_pending = false;
+  }
+
+  Rebalance();
+}
+
+void PlaneAllocator::Rebalance() {
+  std::map<uint32_t, uint32_t> remaining(demand_);
+  // Planes stay with their owner as long as it needs them, moving planes
+  // costs a frame on both displays.
+  for (auto &entry : planes_) {
+    SharedPlane &plane = entry.second;
+    plane.target = kNoPipe;
+    if (plane.owner != kNoPipe && remaining[plane.owner] > 0) {
+      plane.target = plane.owner;
+      remaining[plane.owner]--;
+    }
+  }
+
+  for (auto &entry : planes_) {
+    SharedPlane &plane = entry.second;
+    if (plane.target != kNoPipe)
+      continue;
+
+    uint32_t best = kNoPipe;
+    for (auto &demand : remaining) {
+      if (!(plane.possible_crtcs & (1 << demand.first)) || !demand.second)
+        continue;
+
+      if (best == kNoPipe || demand.second > remaining[best])
+        best = demand.first;
+    }
+
+    // Nobody needs the plane, leave it where it is.
+    if (best == kNoPipe) {
+      plane.target = plane.owner;
+      continue;
+    }
+
+    plane.target = best;
+    remaining[best]--;
+  }
+
+  for (auto &entry : planes_) {
+    if (entry.second.target == entry.second.owner) {
+      entry.second.released = false;
+      entry.second.release_pending = false;
+    }
+  }
+}
+
+}  // namespace hwcomposer
@@ -0,0 +1,101 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef PLANE_ALLOCATOR_H_
+#define PLANE_ALLOCATOR_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace hwcomposer {
+
+// Hands out overlay planes usable by more than one pipe to the displays
+// which have the most layers left over for them, so they end up on the
+// busiest display rather than idling on another one.
+class PlaneAllocator {
+ public:
+  PlaneAllocator();
+  ~PlaneAllocator();
+
+  // Registers a plane usable by all pipes in possible_crtcs. Every display
+  // which can use the plane registers it.
+  void AddSharedPlane(uint32_t plane_id, uint32_t possible_crtcs);
+
+  bool IsShared(uint32_t plane_id) const;
+
+  // Called as pipe starts validating a frame, with the number of its layers
+  // its own planes can't take. Shared planes are reassigned accordingly.
+  void SetDemand(uint32_t pipe, uint32_t demand);
+
+  // Returns true if pipe may use plane_id in the frame being validated.
+  bool AcquirePlane(uint32_t plane_id, uint32_t pipe);
+
+  // Returns true if plane_id is scanned out by pipe, which then has to
+  // disable it once unused.
+  bool IsOwner(uint32_t plane_id, uint32_t pipe) const;
+
+  // Called once pipe committed a frame with the shared planes it enabled.
+  // A plane assigned to another pipe is handed over once a frame of its
+  // owner which no longer uses it has flipped, see FrameFlipped.
+  void FrameCommitted(uint32_t pipe, const std::vector<uint32_t> &enabled);
+
+  // Called once the last frame committed by pipe is on screen. The kernel
+  // rejects commits using a plane till the flip disabling it on another
+  // pipe is done.
+  void FrameFlipped(uint32_t pipe);
+
+  // While pipe is idle its demand counts as 0, so other displays can take
+  // its shared planes.
+  void SetIdle(uint32_t pipe, bool idle);
+
+  // Returns true if pipe owns planes assigned to another pipe, which it has
+  // to commit a frame without to hand them over.
+  bool HasPlanesToRelease(uint32_t pipe) const;
+
+  // Called once pipe stopped presenting for good, e.g. as it shuts down.
+  // Its planes can be taken by other pipes right away.
+  void ReleasePipe(uint32_t pipe);
+
+ private:
+  static const uint32_t kNoPipe = ~0u;
+
+  struct SharedPlane {
+    uint32_t possible_crtcs = 0;
+    // Pipe scanning out from the plane.
+    uint32_t owner = kNoPipe;
+    // Pipe the plane is assigned to, it moves there once owner let go.
+    uint32_t target = kNoPipe;
+    // owner validated a frame without the plane since target changed.
+    bool released = false;
+    // owner committed a frame without the plane, it moves on its flip.
+    bool release_pending = false;
+  };
+
+  // Called with lock_ held.
+  void Rebalance();
+
+  mutable std::mutex lock_;
+  std::map<uint32_t, SharedPlane> planes_;
+  std::map<uint32_t, uint32_t> demand_;
+  std::set<uint32_t> idle_;
+};
+
+}  // namespace hwcomposer
+#endif  // PLANE_ALLOCATOR_H_
@@ -24,14 +24,15 @@
 
 namespace hwcomposer {
 
-HWCThread::HWCThread(int priority) : priority_(priority), initialized_(false) {
+HWCThread::HWCThread(int priority)
+    : priority_(priority), exit_(false), initialized_(false) {
 }
 
 HWCThread::~HWCThread() {
   if (!initialized_)
     return;
 
-  pthread_kill(thread_, SIGTERM);
+  Exit();
   pthread_cond_destroy(&cond_);
   pthread_mutex_destroy(&lock_);
 }
@@ -53,6 +54,7 @@ bool HWCThread::InitWorker(const char *name) {
     return false;
   }
 
+  exit_ = false;
   ret = pthread_create(&thread_, NULL, InternalRoutine, this);
   if (ret) {
     ETRACE("Could not create thread %s %d", name, ret);
@@ -64,6 +66,16 @@ bool HWCThread::InitWorker(const char *name) {
   return true;
 }
 
+void HWCThread::Exit() {
+  if (!initialized_ || exit_.exchange(true))
+    return;
+
+  HandleExit();
+  int ret = pthread_join(thread_, NULL);
+  if (ret)
+    ETRACE("Failed to join thread %d", ret);
+}
+
 int HWCThread::Lock() {
   return pthread_mutex_lock(&lock_);
 }
@@ -78,7 +90,7 @@ void *HWCThread::InternalRoutine(void *arg) {
 
   setpriority(PRIO_PROCESS, 0, thread->priority_);
 
-  while (true) {
+  while (!thread->exit_) {
     thread->Routine();
   }
   return NULL;
@@ -19,6 +19,8 @@
 
 #include <pthread.h>
 #include <stdint.h>
+
+#include <atomic>
 #include <string>
 
 namespace hwcomposer {
@@ -28,6 +30,16 @@ class HWCThread {
   int Lock();
   int Unlock();
 
+  // Stops the thread once the current Routine() returns. HandleExit() gets
+  // called to wake up a Routine() blocked on events, so derived classes
+  // should call this from their destructor while it can still be
+  // dispatched.
+  void Exit();
+
+  bool IsExiting() const {
+    return exit_;
+  }
+
  protected:
   HWCThread(int priority);
   virtual ~HWCThread();
@@ -36,6 +48,9 @@ class HWCThread {
 
   virtual void Routine() = 0;
 
+  virtual void HandleExit() {
+  }
+
  private:
   static void *InternalRoutine(void *HWCThread);
 
@@ -45,6 +60,7 @@ class HWCThread {
   pthread_mutex_t lock_;
   pthread_cond_t cond_;
 
+  std::atomic<bool> exit_;
   bool initialized_;
 };
 
@@ -0,0 +1,278 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#include "hwctrace.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace hwcomposer {
+
+static const uint32_t kMaxTraceArgs = 6;
+// Room for the string arguments of a record, longer ones get truncated.
+static const size_t kTraceStringSize = 96;
+// Needs to be a power of two.
+static const uint64_t kTraceRingSize = 2048;
+
+struct TraceEntry {
+  // Index of the record + 1, 0 while it is being written.
+  std::atomic<uint64_t> sequence;
+  int64_t timestamp;
+  const char *format;
+  uint32_t category;
+  int32_t tid;
+  uint32_t num_args;
+  // String arguments hold an offset into strings rather than a pointer.
+  TraceArg args[kMaxTraceArgs];
+  char strings[kTraceStringSize];
+};
+
+std::atomic<uint32_t> g_trace_categories(0);
+
+static TraceEntry trace_ring[kTraceRingSize];
+static std::atomic<uint64_t> trace_next(0);
+
+void SetTraceCategories(uint32_t categories) {
+  g_trace_categories.store(categories, std::memory_order_relaxed);
+}
+
+static int32_t GetThreadId() {
+  static thread_local int32_t tid = syscall(SYS_gettid);
+  return tid;
+}
+
+void WriteTraceRecord(uint32_t category, const char *format,
+                      const TraceArg *args, uint32_t num_args) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  uint64_t index = trace_next.fetch_add(1, std::memory_order_relaxed);
+  TraceEntry &entry = trace_ring[index & (kTraceRingSize - 1)];
+  entry.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  entry.timestamp = (int64_t)ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+  entry.format = format;
+  entry.category = category;
+  entry.tid = GetThreadId();
+  entry.num_args = std::min(num_args, kMaxTraceArgs);
+  size_t used = 0;
+  for (uint32_t i = 0; i < entry.num_args; i++) {
+    entry.args[i] = args[i];
+    if (args[i].type != TraceArg::kString)
+      continue;
+
+    // The string might not outlive the record, keep a copy.
+    const char *value = args[i].s ? args[i].s : "?";
+    size_t length = strnlen(value, kTraceStringSize - used - 1);
+    memcpy(entry.strings + used, value, length);
+    entry.strings[used + length] = '\0';
+    entry.args[i].u = used;
+    used += std::min(length + 1, kTraceStringSize - used - 1);
+  }
+
+  entry.sequence.store(index + 1, std::memory_order_release);
+}
+
+// Formats one conversion of a printf style spec with the argument recorded
+// for it. Length modifiers are ignored, the argument type decides.
+static void FormatTraceArg(std::string spec, char conversion,
+                           const TraceArg *arg, const char *strings,
+                           std::string *out) {
+  char buffer[256];
+  if (!arg) {
+    out->append("?");
+    return;
+  }
+
+  switch (conversion) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c':
+      if (arg->type == TraceArg::kDouble) {
+        snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(),
+                 static_cast<long long>(arg->d));
+      } else if (conversion == 'c') {
+        snprintf(buffer, sizeof(buffer), (spec + "c").c_str(),
+                 static_cast<int>(arg->i));
+      } else if (conversion == 'd' || conversion == 'i') {
+        snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(),
+                 static_cast<long long>(arg->i));
+      } else {
+        snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(),
+                 static_cast<unsigned long long>(arg->u));
+      }
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+      snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(),
+               arg->type == TraceArg::kDouble
+                   ? arg->d
+                   : static_cast<double>(arg->i));
+      break;
+    case 's':
+      snprintf(buffer, sizeof(buffer), (spec + "s").c_str(),
+               arg->type == TraceArg::kString ? strings + arg->u : "?");
+      break;
+    default:
+      snprintf(buffer, sizeof(buffer), "%p", arg->p);
+      break;
+  }
+
+  out->append(buffer);
+}
+
+static void FormatTraceEntry(const TraceEntry &entry, std::string *out) {
+  const char *format = entry.format;
+  uint32_t arg_index = 0;
+  while (*format) {
+    if (*format != '%') {
+      out->push_back(*format++);
+      continue;
+    }
+
+    format++;
+    if (*format == '%') {
+      out->push_back(*format++);
+      continue;
+    }
+
+    std::string spec("%");
+    while (*format && strchr("-+ #0123456789.", *format))
+      spec.push_back(*format++);
+
+    while (*format && strchr("hljztLq", *format))
+      format++;
+
+    if (!*format)
+      break;
+
+    char conversion = *format++;
+    const TraceArg *arg =
+        arg_index < entry.num_args ? &entry.args[arg_index] : NULL;
+    arg_index++;
+    FormatTraceArg(spec, conversion, arg, entry.strings, out);
+  }
+}
+
+void DumpTraceRing(std::ostringstream *out) {
+  uint64_t last = trace_next.load(std::memory_order_acquire);
+  uint64_t first = last > kTraceRingSize ? last - kTraceRingSize : 0;
+  *out << "Trace categories 0x" << std::hex
+       << g_trace_categories.load(std::memory_order_relaxed) << std::dec
+       << ", " << (last - first) << " records\n";
+  std::string line;
+  for (uint64_t index = first; index < last; index++) {
+    const TraceEntry &entry = trace_ring[index & (kTraceRingSize - 1)];
+    if (entry.sequence.load(std::memory_order_acquire) != index + 1)
+      continue;
+
+    TraceEntry copy;
+    copy.timestamp = entry.timestamp;
+    copy.format = entry.format;
+    copy.category = entry.category;
+    copy.tid = entry.tid;
+    copy.num_args = entry.num_args;
+    for (uint32_t i = 0; i < copy.num_args; i++)
+      copy.args[i] = entry.args[i];
+
+    memcpy(copy.strings, entry.strings, kTraceStringSize);
+
+    // Drop records overwritten while we were copying them.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.sequence.load(std::memory_order_relaxed) != index + 1)
+      continue;
+
+    line.clear();
+    FormatTraceEntry(copy, &line);
+    *out << copy.timestamp / 1000 << " [" << copy.tid << "] " << line
+         << "\n";
+  }
+}
+
+// -2 till we try to open trace_marker, -1 if that failed.
+static std::atomic<int> trace_marker_fd(-2);
+
+static int GetTraceMarkerFd() {
+  int fd = trace_marker_fd.load(std::memory_order_acquire);
+  if (fd != -2)
+    return fd;
+
+  fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    ETRACE("Failed to open trace_marker %s", PRINTERROR());
+
+  int expected = -2;
+  if (!trace_marker_fd.compare_exchange_strong(expected, fd)) {
+    // Another thread got there first.
+    if (fd >= 0)
+      close(fd);
+    fd = expected;
+  }
+
+  return fd;
+}
+
+static int GetTracePid() {
+  static const int pid = getpid();
+  return pid;
+}
+
+static void WriteTraceMarker(const char *buffer, int length) {
+  int fd = GetTraceMarkerFd();
+  if (fd < 0 || length <= 0)
+    return;
+
+  ssize_t ret = write(fd, buffer, std::min<int>(length, 255));
+  (void)ret;
+}
+
+void TraceMarkerBegin(const char *name) {
+  char buffer[256];
+  int length =
+      snprintf(buffer, sizeof(buffer), "B|%d|%s", GetTracePid(), name);
+  WriteTraceMarker(buffer, length);
+}
+
+void TraceMarkerEnd() {
+  char buffer[32];
+  int length = snprintf(buffer, sizeof(buffer), "E|%d", GetTracePid());
+  WriteTraceMarker(buffer, length);
+}
+
+void TraceMarkerCounter(const char *name, uint32_t id, int64_t value) {
+  char buffer[256];
+  int length =
+      snprintf(buffer, sizeof(buffer), "C|%d|%s-%u|%lld", GetTracePid(), name,
+               id, static_cast<long long>(value));
+  WriteTraceMarker(buffer, length);
+}
+
+}  // namespace hwcomposer
@@ -17,12 +17,17 @@
 #ifndef HWC_TRACE_H
 #define HWC_TRACE_H
 
-#include <string>
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <chrono>
 #include <time.h>
 
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
 #include <platformdefines.h>
 
 #include "displayplane.h"
@@ -31,54 +36,189 @@
 extern "C" {
 #endif
 
-//#define ENABLE_DEBUG 1
-//#define ENABLE_DISPLAY_DUMP 1
-//#define ENABLE_DISPLAY_MANAGER_TRACING 1
-//#define ENABLE_PAGE_FLIP_EVENT_TRACING 1
-//#define ENABLE_HOT_PLUG_EVENT_TRACING 1
-//#define FUNCTION_CALL_TRACING 1
-#define COMPOSITOR_TRACING 1
-
-// Helper to automatically preappend classname::functionname to the log message
-#ifdef ENABLE_DEBUG
-#define VTRACE(fmt, ...) VLOG("%s: " fmt, __func__, ##__VA_ARGS__)
-#define DTRACE(fmt, ...) DLOG("%s: " fmt, __func__, ##__VA_ARGS__)
-#define ITRACE(fmt, ...) ILOG("%s: " fmt, __func__, ##__VA_ARGS__)
-#define WTRACE(fmt, ...) WLOG("%s: " fmt, __func__, ##__VA_ARGS__)
-#else
-#define VTRACE(fmt, ...) ((void)0)
-#define DTRACE(fmt, ...) ((void)0)
-#define ITRACE(fmt, ...) ((void)0)
-#define WTRACE(fmt, ...) ((void)0)
-#endif
+namespace hwcomposer {
+
+// Trace categories, all disabled by default. They can be switched at runtime
+// with SetTraceCategories or the debug.hwc.trace property (a mask of these
+// values, read at init and whenever dumpsys runs).
+enum HWCTraceCategory : uint32_t {
+  kTraceDebug = 1 << 0,
+  kTraceFunction = 1 << 1,
+  kTraceDump = 1 << 2,
+  kTracePageFlip = 1 << 3,
+  kTraceDisplayManager = 1 << 4,
+  kTraceHotPlug = 1 << 5,
+  kTraceCompositor = 1 << 6,
+  // Slices and counters written to the kernel trace_marker, to be viewed
+  // alongside kernel and GPU scheduling in systrace or Perfetto.
+  kTraceMarker = 1 << 7
+};
+
+extern std::atomic<uint32_t> g_trace_categories;
+
+inline bool IsTraceEnabled(uint32_t category) {
+  return g_trace_categories.load(std::memory_order_relaxed) & category;
+}
+
+void SetTraceCategories(uint32_t categories);
+
+// Traces are kept unformatted in an in-memory ring and only formatted when
+// dumped. String arguments are copied into the record, up to a small limit
+// shared by all of them, and need to be NUL terminated.
+struct TraceArg {
+  enum Type : uint8_t { kNone, kInt, kUInt, kDouble, kString, kPointer };
+  Type type = kNone;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char *s;
+    const void *p;
+  };
+  TraceArg() : u(0) {
+  }
+};
+
+inline TraceArg MakeTraceArg(const char *value) {
+  TraceArg arg;
+  arg.type = TraceArg::kString;
+  arg.s = value;
+  return arg;
+}
+
+inline TraceArg MakeTraceArg(double value) {
+  TraceArg arg;
+  arg.type = TraceArg::kDouble;
+  arg.d = value;
+  return arg;
+}
+
+template <typename T>
+inline TraceArg MakeTraceArg(const T *value) {
+  TraceArg arg;
+  arg.type = TraceArg::kPointer;
+  arg.p = value;
+  return arg;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value, TraceArg>::type
+MakeTraceArg(T value) {
+  TraceArg arg;
+  if (std::is_signed<T>::value) {
+    arg.type = TraceArg::kInt;
+    arg.i = value;
+  } else {
+    arg.type = TraceArg::kUInt;
+    arg.u = value;
+  }
+  return arg;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_enum<T>::value, TraceArg>::type
+MakeTraceArg(T value) {
+  return MakeTraceArg(
+      static_cast<typename std::underlying_type<T>::type>(value));
+}
+
+void WriteTraceRecord(uint32_t category, const char *format,
+                      const TraceArg *args, uint32_t num_args);
+
+template <typename... Args>
+void TraceRecord(uint32_t category, const char *format, Args... args) {
+  TraceArg trace_args[] = {MakeTraceArg(args)..., TraceArg()};
+  WriteTraceRecord(category, format, trace_args, sizeof...(Args));
+}
+
+// Appends the formatted contents of the trace ring, oldest first.
+void DumpTraceRing(std::ostringstream *out);
+
+// trace_marker backend. name needs to be a literal or otherwise outlive the
+// slice, nothing is allocated or copied.
+void TraceMarkerBegin(const char *name);
+void TraceMarkerEnd();
+void TraceMarkerCounter(const char *name, uint32_t id, int64_t value);
+
+class ScopedTraceMarker {
+ public:
+  ScopedTraceMarker(const char *name)
+      : enabled_(IsTraceEnabled(kTraceMarker)) {
+    if (enabled_)
+      TraceMarkerBegin(name);
+  }
+
+  ~ScopedTraceMarker() {
+    if (enabled_)
+      TraceMarkerEnd();
+  }
+
+ private:
+  bool enabled_;
+};
+
+}  // namespace hwcomposer
+
+#define HWC_TRACE(category, fmt, ...)                                 \
+  do {                                                                \
+    if (hwcomposer::IsTraceEnabled(category))                         \
+      hwcomposer::TraceRecord(category, "%s: " fmt, __func__,         \
+                              ##__VA_ARGS__);                         \
+  } while (0)
+
+#define HWC_TRACE_CONCAT_(a, b) a##b
+#define HWC_TRACE_CONCAT(a, b) HWC_TRACE_CONCAT_(a, b)
+
+// Slice covering the rest of the current scope, slices of inner scopes nest.
+#define HWC_TRACE_SLICE(name) \
+  hwcomposer::ScopedTraceMarker HWC_TRACE_CONCAT(hwc_slice_, __LINE__)(name)
+
+// Counter track name-id, e.g. one per display pipe.
+#define HWC_TRACE_COUNTER(name, id, value)                    \
+  do {                                                        \
+    if (hwcomposer::IsTraceEnabled(hwcomposer::kTraceMarker)) \
+      hwcomposer::TraceMarkerCounter(name, id, value);        \
+  } while (0)
+
+// Helper to automatically preappend functionname to the log message
+#define VTRACE(fmt, ...) HWC_TRACE(hwcomposer::kTraceDebug, fmt, ##__VA_ARGS__)
+#define DTRACE(fmt, ...) HWC_TRACE(hwcomposer::kTraceDebug, fmt, ##__VA_ARGS__)
+#define ITRACE(fmt, ...) HWC_TRACE(hwcomposer::kTraceDebug, fmt, ##__VA_ARGS__)
+#define WTRACE(fmt, ...) HWC_TRACE(hwcomposer::kTraceDebug, fmt, ##__VA_ARGS__)
 #define ETRACE(fmt, ...) ELOG("%s: " fmt, __func__, ##__VA_ARGS__)
 
 // Function call tracing
-#ifdef FUNCTION_CALL_TRACING
 class TraceFunc {
  public:
-  TraceFunc(std::string func_name) {
-    func_name_ = func_name;
-    ILOG("Calling ----- %s", func_name_.c_str());
-    t_ = std::chrono::high_resolution_clock::now();
+  TraceFunc(const char *func_name)
+      : func_name_(func_name),
+        enabled_(hwcomposer::IsTraceEnabled(hwcomposer::kTraceFunction)) {
+    if (!enabled_)
+      return;
+
+    hwcomposer::TraceRecord(hwcomposer::kTraceFunction, "Calling ----- %s",
+                            func_name_);
+    t_ = std::chrono::steady_clock::now();
   }
   ~TraceFunc() {
-    std::chrono::high_resolution_clock::time_point t2 =
-        std::chrono::high_resolution_clock::now();
-    ILOG(
-        "Total time spent in --- %s Time(msec): %lld", func_name_.c_str(),
-        std::chrono::duration_cast<std::chrono::microseconds>(t2 - t_).count());
-    ILOG("Leaving --- %s", func_name_.c_str());
+    if (!enabled_)
+      return;
+
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    hwcomposer::TraceRecord(
+        hwcomposer::kTraceFunction, "Leaving --- %s Time(usec): %lld",
+        func_name_,
+        static_cast<long long>(
+            std::chrono::duration_cast<std::chrono::microseconds>(t2 - t_)
+                .count()));
   }
 
  private:
-  std::chrono::high_resolution_clock::time_point t_;
-  std::string func_name_;
+  std::chrono::steady_clock::time_point t_;
+  const char *func_name_;
+  bool enabled_;
 };
 #define CTRACE() TraceFunc hwctrace(__func__);
-#else
-#define CTRACE() ((void)0)
-#endif
 
 // Arguments tracing
 #if 0
@@ -88,36 +228,28 @@ class TraceFunc {
 #endif
 
 // Useful Debug tracing
-#ifdef ENABLE_DISPLAY_DUMP
-#define DUMPTRACE(fmt, ...) ILOG(fmt, ##__VA_ARGS__)
-#else
-#define DUMPTRACE(fmt, ...) ((void)0)
-#endif
+#define DUMPTRACE(fmt, ...) \
+  HWC_TRACE(hwcomposer::kTraceDump, fmt, ##__VA_ARGS__)
 
 // Page Flip event tracing
-#ifdef ENABLE_PAGE_FLIP_EVENT_TRACING
-#define IPAGEFLIPEVENTTRACE(fmt, ...) ILOG(fmt, ##__VA_ARGS__)
-#else
-#define IPAGEFLIPEVENTTRACE(fmt, ...) ((void)0)
-#endif
+#define IPAGEFLIPEVENTTRACE(fmt, ...) \
+  HWC_TRACE(hwcomposer::kTracePageFlip, fmt, ##__VA_ARGS__)
 
-#ifdef ENABLE_DISPLAY_MANAGER_TRACING
-#define IDISPLAYMANAGERTRACE(fmt, ...) ILOG(fmt, ##__VA_ARGS__)
-#else
-#define IDISPLAYMANAGERTRACE(fmt, ...) ((void)0)
-#endif
+#define IDISPLAYMANAGERTRACE(fmt, ...) \
+  HWC_TRACE(hwcomposer::kTraceDisplayManager, fmt, ##__VA_ARGS__)
 
-#ifdef ENABLE_HOT_PLUG_EVENT_TRACING
-#define IHOTPLUGEVENTTRACE(fmt, ...) ILOG(fmt, ##__VA_ARGS__)
-#else
-#define IHOTPLUGEVENTTRACE(fmt, ...) ((void)0)
-#endif
+#define IHOTPLUGEVENTTRACE(fmt, ...) \
+  HWC_TRACE(hwcomposer::kTraceHotPlug, fmt, ##__VA_ARGS__)
 
-#ifdef COMPOSITOR_TRACING
-#define ICOMPOSITORTRACE(fmt, ...) ILOG(fmt, ##__VA_ARGS__)
-#else
-#define ICOMPOSITORTRACE(fmt, ...) ((void)0)
-#endif
+#define ICOMPOSITORTRACE(fmt, ...) \
+  HWC_TRACE(hwcomposer::kTraceCompositor, fmt, ##__VA_ARGS__)
+
+// Prints a DRM fourcc by value, traces only format their arguments when
+// dumped.
+#define FOURCC_FMT "%c%c%c%c"
+#define FOURCC_ARGS(fourcc)                                         \
+  (fourcc) & 0xff, ((fourcc) >> 8) & 0xff, ((fourcc) >> 16) & 0xff, \
+      ((fourcc) >> 24) & 0xff
 
 // Errors
 #define PRINTERROR() strerror(-errno)
@@ -171,56 +303,56 @@ class TraceFunc {
                      __LINE__);                                              \
   }
 
-#ifdef ENABLE_DISPLAY_DUMP
 #define DUMP_CURRENT_COMPOSITION_PLANES()                                  \
-  frame_++;                                                                \
-  DUMPTRACE(                                                               \
-      "Dumping DisplayPlaneState of Current Composition planes "           \
-      "-----------------------------");                                    \
-  DUMPTRACE("Frame: %d", frame_);                                          \
-  DUMPTRACE("Total Layers for this Frame: %d", layers.size());             \
-  DUMPTRACE("Total Planes in use for this Frame: %d",                      \
-            current_composition_planes.size());                            \
-  int plane_index = 1;                                                     \
-  for (DisplayPlaneState & comp_plane : current_composition_planes) {      \
-    DUMPTRACE("Composition Plane State for Index: %d", plane_index);       \
-    const std::vector<size_t> &source_layers = comp_plane.source_layers(); \
-    switch (comp_plane.GetCompositionState()) {                            \
-      case DisplayPlaneState::State::kRender:                              \
-        DUMPTRACE("DisplayPlane state: kRender. Total layers: %lu",        \
-                  source_layers.size());                                   \
-        DUMPTRACE("Layers Index:");                                        \
-        for (size_t primary_index : source_layers) {                       \
-          DUMPTRACE("index: %d", primary_index);                           \
-          layers.at(primary_index).Dump();                                 \
-        }                                                                  \
-        break;                                                             \
-      case DisplayPlaneState::State::kScanout:                             \
-        if (source_layers.size() > 1)                                      \
-          DUMPTRACE(                                                       \
-              "Plane has more than one layer associated when its type is " \
-              "kScanout. This needs to be fixed.");                        \
-        DUMPTRACE("DisplayPlane State: kScanout. Total layers: %lu",       \
-                  source_layers.size());                                   \
-        DUMPTRACE("Layers Index:");                                        \
-        for (size_t overlay_index : source_layers) {                       \
-          DUMPTRACE("index: %d", overlay_index);                           \
-          layers.at(overlay_index).Dump();                                 \
-        }                                                                  \
-        break;                                                             \
-      default:                                                             \
-        break;                                                             \
+  if (hwcomposer::IsTraceEnabled(hwcomposer::kTraceDump)) {                \
+    frame_++;                                                              \
+    DUMPTRACE(                                                             \
+        "Dumping DisplayPlaneState of Current Composition planes "         \
+        "-----------------------------");                                  \
+    DUMPTRACE("Frame: %d", frame_);                                        \
+    DUMPTRACE("Total Layers for this Frame: %d", layers.size());           \
+    DUMPTRACE("Total Planes in use for this Frame: %d",                    \
+              current_composition_planes.size());                          \
+    int plane_index = 1;                                                   \
+    for (DisplayPlaneState & comp_plane : current_composition_planes) {    \
+      DUMPTRACE("Composition Plane State for Index: %d", plane_index);     \
+      const std::vector<size_t> &source_layers =                           \
+          comp_plane.source_layers();                                      \
+      switch (comp_plane.GetCompositionState()) {                          \
+        case DisplayPlaneState::State::kRender:                            \
+          DUMPTRACE("DisplayPlane state: kRender. Total layers: %lu",      \
+                    source_layers.size());                                 \
+          DUMPTRACE("Layers Index:");                                      \
+          for (size_t primary_index : source_layers) {                     \
+            DUMPTRACE("index: %d", primary_index);                         \
+            layers.at(primary_index).Dump();                               \
+          }                                                                \
+          break;                                                           \
+        case DisplayPlaneState::State::kScanout:                           \
+          if (source_layers.size() > 1)                                    \
+            DUMPTRACE(                                                     \
+                "Plane has more than one layer associated when its "       \
+                "type is kScanout. This needs to be fixed.");              \
+          DUMPTRACE("DisplayPlane State: kScanout. Total layers: %lu",     \
+                    source_layers.size());                                 \
+          DUMPTRACE("Layers Index:");                                      \
+          for (size_t overlay_index : source_layers) {                     \
+            DUMPTRACE("index: %d", overlay_index);                         \
+            layers.at(overlay_index).Dump();                               \
+          }                                                                \
+          break;                                                           \
+        default:                                                           \
+          break;                                                           \
+      }                                                                    \
+      comp_plane.plane()->Dump();                                          \
+      DUMPTRACE("Composition Plane State ends for Index: %d",              \
+                plane_index);                                              \
+      plane_index++;                                                       \
     }                                                                      \
-    comp_plane.plane()->Dump();                                            \
-    DUMPTRACE("Composition Plane State ends for Index: %d", plane_index);  \
-    plane_index++;                                                         \
-  }                                                                        \
-  DUMPTRACE(                                                               \
-      "Dumping DisplayPlaneState of Current Composition planes ends. "     \
-      "-----------------------------");
-#else
-#define DUMP_CURRENT_COMPOSITION_PLANES() ((void)0)
-#endif
+    DUMPTRACE(                                                             \
+        "Dumping DisplayPlaneState of Current Composition planes ends. "   \
+        "-----------------------------");                                  \
+  }
 
 // _cplusplus
 #ifdef _cplusplus
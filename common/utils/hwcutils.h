@@ -0,0 +1,86 @@
+/*
+// Copyright (c) 2016 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+
+#ifndef HWC_UTILS_H_
+#define HWC_UTILS_H_
+
+#include <drm_fourcc.h>
+#include <stdint.h>
+
+#ifndef DRM_FORMAT_P010
+#define DRM_FORMAT_P010 fourcc_code('P', '0', '1', '0')
+#endif
+
+namespace hwcomposer {
+
+// Number of planes a buffer of the given format is made of.
+inline uint32_t GetTotalPlanesForFormat(uint32_t format) {
+  switch (format) {
+    case DRM_FORMAT_NV12:
+    case DRM_FORMAT_NV21:
+    case DRM_FORMAT_NV16:
+    case DRM_FORMAT_P010:
+      return 2;
+    case DRM_FORMAT_YUV420:
+    case DRM_FORMAT_YVU420:
+      return 3;
+    default:
+      break;
+  }
+
+  return 1;
+}
+
+// Returns true if buffers with modifier are render compressed. The
+// compression data comes as an extra plane after the ones of the format.
+inline bool IsCompressedModifier(uint64_t modifier) {
+  return modifier == I915_FORMAT_MOD_Y_TILED_CCS ||
+         modifier == I915_FORMAT_MOD_Yf_TILED_CCS;
+}
+
+// Number of planes of a buffer with the given format and modifier.
+inline uint32_t GetTotalPlanes(uint32_t format, uint64_t modifier) {
+  uint32_t planes = GetTotalPlanesForFormat(format);
+  if (IsCompressedModifier(modifier))
+    planes++;
+
+  return planes;
+}
+
+// Formats produced by video decoders, which we want to keep on overlay
+// planes rather than color convert with GPU.
+inline bool IsSupportedMediaFormat(uint32_t format) {
+  switch (format) {
+    case DRM_FORMAT_NV12:
+    case DRM_FORMAT_NV21:
+    case DRM_FORMAT_NV16:
+    case DRM_FORMAT_P010:
+    case DRM_FORMAT_YUV420:
+    case DRM_FORMAT_YVU420:
+    case DRM_FORMAT_YUYV:
+    case DRM_FORMAT_YVYU:
+    case DRM_FORMAT_UYVY:
+    case DRM_FORMAT_VYUY:
+      return true;
+    default:
+      break;
+  }
+
+  return false;
+}
+
+}  // namespace hwcomposer
+#endif  // HWC_UTILS_H_
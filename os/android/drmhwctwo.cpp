@@ -20,6 +20,7 @@
 #include "drmhwctwo.h"
 
 #include <inttypes.h>
+#include <sstream>
 #include <string>
 
 #include <cutils/log.h>
@@ -28,6 +29,7 @@
 #include <hardware/hwcomposer2.h>
 
 #include <hwcdefs.h>
+#include <hwctrace.h>
 #include <internaldisplay.h>
 #include <gpudevice.h>
 #include <nativebufferhandler.h>
@@ -58,13 +60,18 @@ DrmHwcTwo::DrmHwcTwo() {
   getFunction = HookDevGetFunction;
 }
 
-HWC2::Error DrmHwcTwo::Init() {
-  displays_.emplace(std::piecewise_construct,
-                    std::forward_as_tuple(HWC_DISPLAY_PRIMARY),
-                    std::forward_as_tuple(&device_, HWC_DISPLAY_PRIMARY,
-                                          HWC2::DisplayType::Physical));
+// debug.hwc.trace holds a mask of hwcomposer::HWCTraceCategory values.
+static void UpdateTraceCategories() {
+  char value[PROPERTY_VALUE_MAX];
+  property_get("debug.hwc.trace", value, "0");
+  hwcomposer::SetTraceCategories(strtoul(value, NULL, 0));
+}
 
-  displays_.at(HWC_DISPLAY_PRIMARY).Init();
+HWC2::Error DrmHwcTwo::Init() {
+  UpdateTraceCategories();
+  displays_[HWC_DISPLAY_PRIMARY].reset(new HwcDisplay(
+      &device_, HWC_DISPLAY_PRIMARY, HWC2::DisplayType::Physical));
+  displays_[HWC_DISPLAY_PRIMARY]->Init();
   return HWC2::Error::None;
 }
 
@@ -81,12 +88,10 @@ static inline void supported(char const *func) {
 HWC2::Error DrmHwcTwo::CreateVirtualDisplay(uint32_t width, uint32_t height,
                                             int32_t *format,
                                             hwc2_display_t *display) {
-  displays_.emplace(std::piecewise_construct,
-                    std::forward_as_tuple(HWC_DISPLAY_VIRTUAL),
-                    std::forward_as_tuple(&device_, HWC_DISPLAY_VIRTUAL,
-                                          HWC2::DisplayType::Virtual));
+  displays_[HWC_DISPLAY_VIRTUAL].reset(new HwcDisplay(
+      &device_, HWC_DISPLAY_VIRTUAL, HWC2::DisplayType::Virtual));
   *display = (hwc2_display_t)HWC_DISPLAY_VIRTUAL;
-  displays_.at(*display).Init();
+  displays_[HWC_DISPLAY_VIRTUAL]->Init();
   if (*format == HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED) {
     // fallback to RGBA_8888, align with framework requirement
     *format = HAL_PIXEL_FORMAT_RGBA_8888;
@@ -101,13 +106,31 @@ HWC2::Error DrmHwcTwo::DestroyVirtualDisplay(hwc2_display_t display) {
       return HWC2::Error::BadDisplay;
     }
 
-    displays_.erase(display);
+    displays_[display].reset();
     return HWC2::Error::None;
 }
 
 void DrmHwcTwo::Dump(uint32_t *size, char *buffer) {
-  // TODO: Implement dump
-  unsupported(__func__, size, buffer);
+  supported(__func__);
+  if (!buffer) {
+    UpdateTraceCategories();
+    std::ostringstream out;
+    out << "-- hwcomposer --\n";
+    for (auto &display : displays_) {
+      if (display)
+        display->Dump(&out);
+    }
+
+    hwcomposer::DumpTraceRing(&out);
+
+    dump_string_ = out.str();
+    *size = static_cast<uint32_t>(dump_string_.size());
+    return;
+  }
+
+  *size = std::min<uint32_t>(static_cast<uint32_t>(dump_string_.size()),
+                             *size);
+  strncpy(buffer, dump_string_.c_str(), *size);
 }
 
 uint32_t DrmHwcTwo::GetMaxVirtualDisplayCount() {
@@ -129,9 +152,10 @@ HWC2::Error DrmHwcTwo::RegisterCallback(int32_t descriptor,
       break;
     }
     case HWC2::Callback::Vsync: {
-      for (std::pair<const hwc2_display_t, DrmHwcTwo::HwcDisplay> &d :
-           displays_)
-        d.second.RegisterVsyncCallback(data, function);
+      for (auto &display : displays_) {
+        if (display)
+          display->RegisterVsyncCallback(data, function);
+      }
       break;
     }
     default:
@@ -164,6 +188,26 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init() {
       ALOGE("Failed to retrieve display %d", display);
       return HWC2::Error::BadDisplay;
     }
+
+    // Composes each display on its own thread, useful with several
+    // displays active.
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.hwc.present_worker", value, "0");
+    if (atoi(value) && !display_->EnablePresentWorker())
+      ALOGE("Failed to enable present worker for display %d", display);
+
+    // Adaptive sync, for panels which support it.
+    property_get("debug.hwc.vrr", value, "0");
+    if (atoi(value) && !display_->SetVariableRefresh(true))
+      ALOGI("Adaptive sync not supported by display %d", display);
+
+    // Lower refresh rate while nothing changes on screen.
+    property_get("debug.hwc.idle_downclock", value, "0");
+    if (atoi(value) && !display_->EnableIdleDownclock())
+      ALOGI("Idle downclock not supported by display %d", display);
+
+    property_get("debug.hwc.composition_budget_mb", value, "0");
+    display_->SetCompositionMemoryBudget(atoi(value));
   }
 
   // Fetch the number of modes from the display
@@ -172,10 +216,9 @@ HWC2::Error DrmHwcTwo::HwcDisplay::Init() {
   if (err != HWC2::Error::None || !num_configs)
     return err;
 
-  // Grab the first mode, we'll choose this as the active mode
+  // Start with the mode the display picked on connect, its preferred one.
   hwc2_config_t default_config;
-  num_configs = 1;
-  err = GetDisplayConfigs(&num_configs, &default_config);
+  err = GetActiveConfig(&default_config);
   if (err != HWC2::Error::None)
     return err;
 
@@ -283,8 +326,15 @@ HWC2::Error DrmHwcTwo::HwcDisplay::GetDisplayAttribute(hwc2_config_t config,
       break;
     case HWC2::Attribute::VsyncPeriod:
       // in nanoseconds
+      if (display_->GetDisplayAttribute(
+              config, hwcomposer::HWCDisplayAttribute::kVsyncPeriod, value))
+        break;
+
+      // Displays without mode timings only know the rounded rate.
       display_->GetDisplayAttribute(
           config, hwcomposer::HWCDisplayAttribute::kRefreshRate, value);
+      if (*value > 0)
+        *value = 1000 * 1000 * 1000 / *value;
       break;
     case HWC2::Attribute::DpiX:
       // Dots per 1000 inches
@@ -321,6 +371,12 @@ HWC2::Error DrmHwcTwo::HwcDisplay::GetDisplayName(uint32_t *size, char *name) {
   return HWC2::Error::None;
 }
 
+void DrmHwcTwo::HwcDisplay::Dump(std::ostringstream *out) {
+  *out << "Display " << handle_ << ", frames presented " << frame_no_
+       << "\n";
+  display_->Dump(out);
+}
+
 HWC2::Error DrmHwcTwo::HwcDisplay::GetDisplayRequests(int32_t *display_requests,
                                                       uint32_t *num_elements,
                                                       hwc2_layer_t *layers,
@@ -459,6 +515,17 @@ HWC2::Error DrmHwcTwo::HwcDisplay::SetColorMode(int32_t mode) {
   return HWC2::Error::None;
 }
 
+HWC2::Error DrmHwcTwo::HwcDisplay::SetCursorPosition(hwc2_layer_t layer,
+                                                     int32_t x, int32_t y) {
+  supported(__func__);
+  HwcLayer &cursor = get_layer(layer);
+  cursor.SetCursorPosition(x, y);
+  // Move the cursor plane right away rather than waiting for the next
+  // validate/present cycle. If the display can't, the next frame will.
+  display_->SetCursorPosition(cursor.GetLayer()->GetNativeHandle(), x, y);
+  return HWC2::Error::None;
+}
+
 HWC2::Error DrmHwcTwo::HwcDisplay::SetColorTransform(const float *matrix,
                                                      int32_t hint) {
   supported(__func__);
@@ -816,8 +883,9 @@ hwc2_function_pointer_t DrmHwcTwo::HookDevGetFunction(
     // Layer functions
     case HWC2::FunctionDescriptor::SetCursorPosition:
       return ToHook<HWC2_PFN_SET_CURSOR_POSITION>(
-          LayerHook<decltype(&HwcLayer::SetCursorPosition),
-                    &HwcLayer::SetCursorPosition, int32_t, int32_t>);
+          DisplayHook<decltype(&HwcDisplay::SetCursorPosition),
+                      &HwcDisplay::SetCursorPosition, hwc2_layer_t, int32_t,
+                      int32_t>);
     case HWC2::FunctionDescriptor::SetLayerBlendMode:
       return ToHook<HWC2_PFN_SET_LAYER_BLEND_MODE>(
           LayerHook<decltype(&HwcLayer::SetLayerBlendMode),
@@ -156,6 +156,7 @@ class DrmHwcTwo : public hwc2_device_t {
     HWC2::Error SetClientTarget(buffer_handle_t target, int32_t acquire_fence,
                                 int32_t dataspace, hwc_region_t damage);
     HWC2::Error SetColorMode(int32_t mode);
+    HWC2::Error SetCursorPosition(hwc2_layer_t layer, int32_t x, int32_t y);
     HWC2::Error SetColorTransform(const float *matrix, int32_t hint);
     HWC2::Error SetOutputBuffer(buffer_handle_t buffer, int32_t release_fence);
     HWC2::Error SetPowerMode(int32_t mode);
@@ -165,6 +166,8 @@ class DrmHwcTwo : public hwc2_device_t {
       return layers_.at(layer);
     }
 
+    void Dump(std::ostringstream *out);
+
    private:
     void AddFenceToRetireFence(int fd);
 
@@ -196,20 +199,30 @@ class DrmHwcTwo : public hwc2_device_t {
     return static_cast<T>(((*hwc).*func)(std::forward<Args>(args)...));
   }
 
+  // Display handles are the fixed HWC_DISPLAY_* ids, so hooks index
+  // displays_ directly.
+  HwcDisplay *GetHwcDisplay(hwc2_display_t handle) {
+    return handle < HWC_NUM_DISPLAY_TYPES ? displays_[handle].get() : NULL;
+  }
+
   template <typename HookType, HookType func, typename... Args>
   static int32_t DisplayHook(hwc2_device_t *dev, hwc2_display_t display_handle,
                              Args... args) {
-    DrmHwcTwo *hwc = toDrmHwcTwo(dev);
-    HwcDisplay &display = hwc->displays_.at(display_handle);
-    return static_cast<int32_t>((display.*func)(std::forward<Args>(args)...));
+    HwcDisplay *display = toDrmHwcTwo(dev)->GetHwcDisplay(display_handle);
+    if (!display)
+      return static_cast<int32_t>(HWC2::Error::BadDisplay);
+
+    return static_cast<int32_t>((display->*func)(std::forward<Args>(args)...));
   }
 
   template <typename HookType, HookType func, typename... Args>
   static int32_t LayerHook(hwc2_device_t *dev, hwc2_display_t display_handle,
                            hwc2_layer_t layer_handle, Args... args) {
-    DrmHwcTwo *hwc = toDrmHwcTwo(dev);
-    HwcDisplay &display = hwc->displays_.at(display_handle);
-    HwcLayer &layer = display.get_layer(layer_handle);
+    HwcDisplay *display = toDrmHwcTwo(dev)->GetHwcDisplay(display_handle);
+    if (!display)
+      return static_cast<int32_t>(HWC2::Error::BadDisplay);
+
+    HwcLayer &layer = display->get_layer(layer_handle);
     return static_cast<int32_t>((layer.*func)(std::forward<Args>(args)...));
   }
 
@@ -233,7 +246,9 @@ class DrmHwcTwo : public hwc2_device_t {
   hwcomposer::GpuDevice device_;
   std::shared_ptr<hwcomposer::NativeBufferHandler>
       buffer_handler_;  // Shared with HwcDisplay
-  std::map<hwc2_display_t, HwcDisplay> displays_;
+  std::unique_ptr<HwcDisplay> displays_[HWC_NUM_DISPLAY_TYPES];
   std::map<HWC2::Callback, HwcCallback> callbacks_;
+  // Kept between the size query and the copy of a dump.
+  std::string dump_string_;
 };
 }
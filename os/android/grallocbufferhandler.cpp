@@ -16,13 +16,40 @@
 
 #include "grallocbufferhandler.h"
 
+#include <drm_fourcc.h>
+#include <i915_drm.h>
+#include <xf86drm.h>
 #include <xf86drmMode.h>
 
 #include <hwcdefs.h>
 #include <hwctrace.h>
+#include <hwcutils.h>
 
 namespace hwcomposer {
 
+// Maps the tiling of gem_handle to a format modifier. Returns
+// DRM_FORMAT_MOD_INVALID if the kernel driver can't tell, i.e. isn't i915.
+static uint64_t GetGemModifier(uint32_t fd, uint32_t gem_handle) {
+  struct drm_i915_gem_get_tiling get_tiling;
+  memset(&get_tiling, 0, sizeof(get_tiling));
+  get_tiling.handle = gem_handle;
+  if (drmIoctl(fd, DRM_IOCTL_I915_GEM_GET_TILING, &get_tiling))
+    return DRM_FORMAT_MOD_INVALID;
+
+  switch (get_tiling.tiling_mode) {
+    case I915_TILING_NONE:
+      return DRM_FORMAT_MOD_LINEAR;
+    case I915_TILING_X:
+      return I915_FORMAT_MOD_X_TILED;
+    case I915_TILING_Y:
+      return I915_FORMAT_MOD_Y_TILED;
+    default:
+      break;
+  }
+
+  return DRM_FORMAT_MOD_INVALID;
+}
+
 // static
 NativeBufferHandler *NativeBufferHandler::CreateInstance(uint32_t fd) {
   GrallocBufferHandler *handler = new GrallocBufferHandler(fd);
@@ -87,6 +114,24 @@ bool GrallocBufferHandler::ImportBuffer(buffer_handle_t handle, HwcBuffer *bo) {
     return false;
   }
 
+  // Gralloc doesn't report modifiers, derive them from the tiling of the
+  // gem object of each plane.
+  uint32_t total_planes = GetTotalPlanesForFormat(bo->format);
+  for (uint32_t i = 0; i < 4; i++) {
+    uint32_t gem_handle = bo->gem_handles[i] ? bo->gem_handles[i]
+                                             : bo->gem_handles[0];
+    bo->modifiers[i] = i < total_planes ? GetGemModifier(fd_, gem_handle)
+                                        : DRM_FORMAT_MOD_INVALID;
+  }
+
+  // A Y tiled buffer with a plane more than its format has is render
+  // compressed, the extra plane holding the compression data.
+  if (bo->modifiers[0] == I915_FORMAT_MOD_Y_TILED && total_planes < 4 &&
+      bo->pitches[total_planes]) {
+    for (uint32_t i = 0; i <= total_planes; i++)
+      bo->modifiers[i] = I915_FORMAT_MOD_Y_TILED_CCS;
+  }
+
   uint32_t usage = 0;
   if (bo->usage & GRALLOC_USAGE_CURSOR)
     usage |= hwcomposer::kLayerCursor;
@@ -94,6 +139,9 @@ bool GrallocBufferHandler::ImportBuffer(buffer_handle_t handle, HwcBuffer *bo) {
   if (bo->usage & GRALLOC_USAGE_PROTECTED)
     usage |= hwcomposer::kLayerProtected;
 
+  if (hwcomposer::IsSupportedMediaFormat(bo->format))
+    usage |= hwcomposer::kLayerVideo;
+
   bo->usage = usage;
 
   return true;
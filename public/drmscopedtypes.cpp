@@ -53,6 +53,10 @@ void DrmPropertyDeleter::operator()(drmModePropertyRes* property) const {
   drmModeFreeProperty(property);
 }
 
+void DrmPropertyBlobDeleter::operator()(drmModePropertyBlobRes* blob) const {
+  drmModeFreePropertyBlob(blob);
+}
+
 void DrmAtomicReqDeleter::operator()(drmModeAtomicReq* property) const {
   drmModeAtomicFree(property);
 }
@@ -57,6 +57,9 @@ struct DrmPlaneResDeleter {
 struct DrmPropertyDeleter {
   void operator()(drmModePropertyRes* property) const;
 };
+struct DrmPropertyBlobDeleter {
+  void operator()(drmModePropertyBlobRes* blob) const;
+};
 
 struct DrmAtomicReqDeleter {
   void operator()(drmModeAtomicReq* property) const;
@@ -74,6 +77,8 @@ typedef std::unique_ptr<drmModePlaneRes, DrmPlaneResDeleter>
     ScopedDrmPlaneResPtr;
 typedef std::unique_ptr<drmModePropertyRes, DrmPropertyDeleter>
     ScopedDrmPropertyPtr;
+typedef std::unique_ptr<drmModePropertyBlobRes, DrmPropertyBlobDeleter>
+    ScopedDrmPropertyBlobPtr;
 typedef std::unique_ptr<drmModeAtomicReq, DrmAtomicReqDeleter>
     ScopedDrmAtomicReqPtr;
 }  // namespace hwcomposer
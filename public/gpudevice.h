@@ -20,6 +20,7 @@
 #ifdef UDEV_SUPPORT
 #include <libudev.h>
 #endif
+#include <map>
 #include <vector>
 
 #include <drmscopedtypes.h>
@@ -29,11 +30,13 @@
 
 namespace hwcomposer {
 
+class CommitCoordinator;
 class DisplayPlaneManager;
 class DisplayPlane;
 class Headless;
 class NativeBufferHandler;
 class NativeDisplay;
+class PlaneAllocator;
 
 class GpuDevice {
  public:
@@ -72,21 +75,73 @@ class GpuDevice {
 
    protected:
     void Routine() override;
+    void HandleExit() override;
 
    private:
+    // Tags the fds multiplexed by the epoll loop in Routine().
+    // Vsync timer of display i is tagged kVSyncTimer + i.
+    enum EventSource {
+      kDrmEvent,
+      kHotPlugEvent,
+      kHotPlugTimer,
+      kWakeUp,
+      kVSyncTimer
+    };
+
+    // Displays handed out by GetDisplay(). A new table replaces the
+    // published one on every update, so lookups don't need the lock.
+    struct DisplayTable {
+      // Indexed by pipe.
+      std::vector<NativeDisplay*> displays;
+      // Set while no display is connected.
+      NativeDisplay* headless = NULL;
+    };
+
+    // Last known state of a connector. Only touched by DisplayManager
+    // thread.
+    struct ConnectorState {
+      ScopedDrmConnectorPtr connector;
+      // Display driven by the connector, NULL while disconnected.
+      NativeDisplay* display = NULL;
+    };
+
+    bool InitHotPlug();
+    bool AddEventSource(int fd, uint32_t source);
     void HotPlugEventHandler();
+    // Queues connector_id, or all connectors if 0, for an update once the
+    // hot plug timer expires.
+    void QueueHotPlug(uint32_t connector_id);
+    void ArmHotPlugTimer();
+    void HotPlugTimerHandler();
+    void ProcessHotPlug();
+    // Reconfigures the displays of connectors whose state changed.
+    bool UpdateConnectors(const std::vector<uint32_t>& connector_ids);
+    // Called with the lock held.
+    void PublishDisplayTable();
 #ifdef UDEV_SUPPORT
-    struct udev* udev_;
-    struct udev_monitor* monitor_;
+    struct udev* udev_ = NULL;
+    struct udev_monitor* monitor_ = NULL;
 #endif
+    // Outlives the displays using it.
+    std::unique_ptr<CommitCoordinator> commit_coordinator_;
+    std::unique_ptr<PlaneAllocator> plane_allocator_;
     std::unique_ptr<NativeBufferHandler> buffer_handler_;
     std::unique_ptr<NativeDisplay> headless_;
     std::unique_ptr<NativeDisplay> virtual_display_;
     std::vector<std::unique_ptr<NativeDisplay>> displays_;
     int fd_;
     ScopedFd hotplug_fd_;
-    uint32_t select_fd_;
-    fd_set fd_set_;
+    ScopedFd epoll_fd_;
+    // Bursts of uevents on hot plug are coalesced into one display update
+    // once this timer expires.
+    ScopedFd hotplug_timer_fd_;
+    // Written to wake up Routine() from other threads.
+    ScopedFd wake_fd_;
+    // Accessed with std::atomic_load/atomic_store only.
+    std::shared_ptr<const DisplayTable> display_table_;
+    std::map<uint32_t, ConnectorState> connectors_;
+    std::vector<uint32_t> hotplug_connectors_;
+    bool hotplug_all_connectors_ = false;
   };
 
   DisplayManager display_manager_;
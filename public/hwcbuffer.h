@@ -28,6 +28,9 @@ struct HwcBuffer {
   uint32_t gem_handles[4];
   uint32_t prime_fd;
   uint32_t usage;
+  // Per plane format modifier describing tiling/compression layout.
+  // DRM_FORMAT_MOD_INVALID if layout is implied by the gem object.
+  uint64_t modifiers[4];
 };
 
 #endif  // HWC_BUFFER_H_
@@ -53,7 +53,9 @@ enum class HWCDisplayAttribute : int32_t {
   kHeight = 2,
   kRefreshRate = 3,
   kDpiX = 4,
-  kDpiY = 5
+  kDpiY = 5,
+  // In nanoseconds, exact where kRefreshRate is rounded to whole Hz.
+  kVsyncPeriod = 6
 };
 
 enum class DisplayType : int32_t {
@@ -63,5 +65,25 @@ enum class DisplayType : int32_t {
   kHeadless = 3
 };
 
+// Points in the life of a frame recorded by a display's frame timeline.
+enum class FrameStage : int32_t {
+  kPresent = 0,            // Present called.
+  kImport = 1,             // Buffers imported (BeginUpdate).
+  kValidate = 2,           // Planes validated, including TEST_ONLY commits.
+  kCompositionSubmit = 3,  // GPU composition submitted.
+  kCompositionDone = 4,    // GPU composition fence signalled.
+  kCommit = 5,             // Atomic commit issued.
+  kFlip = 6,               // Page flip event received.
+  kNumStages = 7
+};
+
+// Timestamps of a frame in CLOCK_MONOTONIC ns. Stages the frame never went
+// through, i.e. no GPU composition or dropped before commit, are 0.
+struct FrameTiming {
+  uint64_t frame = 0;
+  uint32_t test_commits = 0;
+  int64_t timestamps[static_cast<int>(FrameStage::kNumStages)] = {0};
+};
+
 }  // namespace hardware
 #endif  // HWC_DEFS_H_
@@ -30,6 +30,10 @@ class OverlayBuffer;
 struct HwcLayer {
   ScopedFd acquire_fence;
   NativeFence release_fence;
+  // Set by the display when the current buffer is only read by GPU
+  // composition, signalled once that is done. It is handed out as the
+  // release fence of the next frame instead of waiting for a page flip.
+  ScopedFd gpu_read_fence;
 
   void SetNativeHandle(HWCNativeHandle handle);
 
@@ -19,6 +19,9 @@
 
 #include <stdint.h>
 
+#include <sstream>
+#include <vector>
+
 #include <drmscopedtypes.h>
 #include <hwcdefs.h>
 #include <platformdefines.h>
@@ -71,6 +74,53 @@ class NativeDisplay {
                                     uint32_t display_id) = 0;
   virtual void VSyncControl(bool enabled) = 0;
 
+  // Moves the cursor layer backed by handle to x, y without a full
+  // Present. Returns false if the display can't do this on its own.
+  virtual bool SetCursorPosition(HWCNativeHandle /*handle*/, int32_t /*x*/,
+                                 int32_t /*y*/) {
+    return false;
+  }
+
+  // Frames are committed margin_us before the predicted vblank, letting a
+  // newer frame presented in the meantime replace the queued one. Zero
+  // commits frames as soon as possible.
+  virtual void SetVBlankLatchMargin(uint32_t /*margin_us*/) {
+  }
+
+  // Moves import, validation and composition of presented frames to a
+  // thread owned by the display, so Present returns without waiting for
+  // them. Returns false if not supported.
+  virtual bool EnablePresentWorker() {
+    return false;
+  }
+
+  // On adaptive sync panels, commits frames as they arrive instead of at
+  // fixed vblanks. Returns false if the display can't do this.
+  virtual bool SetVariableRefresh(bool /*enable*/) {
+    return false;
+  }
+
+  // Switches to the lowest refresh rate mode of the current resolution
+  // while the screen is idle. Returns false if not supported.
+  virtual bool EnableIdleDownclock() {
+    return false;
+  }
+
+  // Caps the memory of buffers GPU composition renders into. Zero picks a
+  // default based on the display size.
+  virtual void SetCompositionMemoryBudget(uint32_t /*budget_mb*/) {
+  }
+
+  // Fills frames with stage timestamps of up to count most recent frames.
+  virtual void GetFrameTimings(uint32_t /*count*/,
+                               std::vector<FrameTiming> *frames) {
+    frames->clear();
+  }
+
+  // Appends human readable state of the display, used by dumpsys.
+  virtual void Dump(std::ostringstream * /*out*/) {
+  }
+
   // Virtual display related.
   virtual void InitVirtualDisplay(uint32_t /*width*/, uint32_t /*height*/) {
   }